@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <gmp.h>
+
+#include "alloc.hpp"
+
+// size classes of small blocks, header included: 2^ALLOC_MIN_SHIFT .. 2^ALLOC_MAX_SHIFT
+static const int ALLOC_MIN_SHIFT = 6;
+static const int ALLOC_MAX_SHIFT = 20;
+static const int ALLOC_CLASSES = ALLOC_MAX_SHIFT - ALLOC_MIN_SHIFT + 1;
+// bytes kept per size class in every thread cache
+static const size_t ALLOC_CLASS_CACHE = 1 << 22;
+static const size_t ALLOC_HUGE_PAGE = 1 << 21;
+
+// in front of every block, keeps the data 16 bytes aligned
+struct BlockHeader {
+    // size class of a small block, or mapped length of a large one
+    size_t size;
+    size_t large;
+};
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// trivially destructible, so that it can still be used while the thread exits
+struct ThreadCache {
+    FreeBlock* lists[ALLOC_CLASSES];
+    size_t counts[ALLOC_CLASSES];
+    bool registered, dead;
+};
+
+static thread_local ThreadCache thread_cache;
+static pthread_key_t thread_cache_key;
+static bool installed = false;
+
+static size_t large_cache_limit = 0, large_cache_bytes = 0;
+static std::multimap<size_t, void*> large_cache;
+static std::mutex large_mtx;
+// set by every thread which allocates a large block, it only ever goes from true to false
+static std::atomic<bool> huge_pages{true};
+
+static std::atomic<size_t> stat_allocs{0}, stat_bytes{0}, stat_reused{0}, stat_in_use{0}, stat_peak{0};
+
+static void CountAlloc(size_t size, bool reused) {
+    stat_allocs.fetch_add(1, std::memory_order_relaxed);
+    stat_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (reused) stat_reused.fetch_add(1, std::memory_order_relaxed);
+    size_t in_use = stat_in_use.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = stat_peak.load(std::memory_order_relaxed);
+    while (in_use > peak && !stat_peak.compare_exchange_weak(peak, in_use, std::memory_order_relaxed));
+}
+
+static void CountFree(size_t size) {
+    stat_in_use.fetch_sub(size, std::memory_order_relaxed);
+}
+
+// give the blocks of an exiting thread back to malloc
+static void ReleaseThreadCache(void* arg) {
+    ThreadCache* cache = static_cast<ThreadCache*>(arg);
+    for (int c = 0; c < ALLOC_CLASSES; c++) {
+        while (cache->lists[c]) {
+            FreeBlock* block = cache->lists[c];
+            cache->lists[c] = block->next;
+            free(block);
+        }
+        cache->counts[c] = 0;
+    }
+    cache->dead = true;
+}
+
+static ThreadCache* GetThreadCache() {
+    ThreadCache* cache = &thread_cache;
+    if (!cache->registered) {
+        cache->registered = true;
+        pthread_setspecific(thread_cache_key, cache);
+    }
+
+    return cache->dead ? nullptr : cache;
+}
+
+static int SizeClass(size_t size) {
+    int c = 0;
+    while ((static_cast<size_t>(1) << (c + ALLOC_MIN_SHIFT)) < size) c++;
+
+    return c;
+}
+
+static void* MapLarge(size_t length) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (!huge_pages.load(std::memory_order_relaxed)) flags |= MAP_POPULATE;
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED) return nullptr;
+    // without transparent huge pages, pre-fault the next blocks instead
+    if (huge_pages.load(std::memory_order_relaxed) && madvise(p, length, MADV_HUGEPAGE) != 0) huge_pages.store(false, std::memory_order_relaxed);
+
+    return p;
+}
+
+static size_t LargeLength(size_t size) {
+    size_t unit = size >= ALLOC_HUGE_PAGE ? ALLOC_HUGE_PAGE : 4096;
+    return (size + unit - 1) / unit * unit;
+}
+
+static void* AllocLarge(size_t size) {
+    size_t length = LargeLength(size);
+    void* p = nullptr;
+    {
+        // the smallest cached block which fits, and does not waste more than half of it
+        std::lock_guard<std::mutex> lock(large_mtx);
+        auto it = large_cache.lower_bound(length);
+        if (it != large_cache.end() && it->first <= 2 * length) {
+            length = it->first;
+            p = it->second;
+            large_cache_bytes -= length;
+            large_cache.erase(it);
+        }
+    }
+    bool reused = p != nullptr;
+    if (!p) p = MapLarge(length);
+    if (!p) return nullptr;
+
+    BlockHeader* header = static_cast<BlockHeader*>(p);
+    header->size = length;
+    header->large = 1;
+    CountAlloc(length, reused);
+
+    return header + 1;
+}
+
+static void FreeLarge(BlockHeader* header) {
+    size_t length = header->size;
+    CountFree(length);
+    {
+        std::lock_guard<std::mutex> lock(large_mtx);
+        if (large_cache_bytes + length <= large_cache_limit) {
+            large_cache.emplace(length, header);
+            large_cache_bytes += length;
+            return;
+        }
+        // make room by dropping the smallest blocks, which are the cheapest to map again
+        while (!large_cache.empty() && large_cache_bytes + length > large_cache_limit && large_cache.begin()->first < length) {
+            munmap(large_cache.begin()->second, large_cache.begin()->first);
+            large_cache_bytes -= large_cache.begin()->first;
+            large_cache.erase(large_cache.begin());
+        }
+        if (large_cache_bytes + length <= large_cache_limit) {
+            large_cache.emplace(length, header);
+            large_cache_bytes += length;
+            return;
+        }
+    }
+    munmap(header, length);
+}
+
+static void* GmpAlloc(size_t size) {
+    size += sizeof(BlockHeader);
+    if (size > (static_cast<size_t>(1) << ALLOC_MAX_SHIFT)) {
+        void* p = AllocLarge(size);
+        if (!p) abort();
+        return p;
+    }
+
+    int c = SizeClass(size);
+    size_t class_size = static_cast<size_t>(1) << (c + ALLOC_MIN_SHIFT);
+    ThreadCache* cache = GetThreadCache();
+    void* p = nullptr;
+    if (cache && cache->lists[c]) {
+        p = cache->lists[c];
+        cache->lists[c] = cache->lists[c]->next;
+        cache->counts[c]--;
+    }
+    bool reused = p != nullptr;
+    if (!p) p = malloc(class_size);
+    if (!p) abort();
+
+    BlockHeader* header = static_cast<BlockHeader*>(p);
+    header->size = c;
+    header->large = 0;
+    CountAlloc(class_size, reused);
+
+    return header + 1;
+}
+
+static void GmpFree(void* ptr, size_t) {
+    if (!ptr) return;
+    BlockHeader* header = static_cast<BlockHeader*>(ptr) - 1;
+    if (header->large) {
+        FreeLarge(header);
+        return;
+    }
+
+    int c = static_cast<int>(header->size);
+    size_t class_size = static_cast<size_t>(1) << (c + ALLOC_MIN_SHIFT);
+    CountFree(class_size);
+    ThreadCache* cache = GetThreadCache();
+    if (!cache || cache->counts[c] >= std::max<size_t>(ALLOC_CLASS_CACHE / class_size, 4)) {
+        free(header);
+        return;
+    }
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(header);
+    block->next = cache->lists[c];
+    cache->lists[c] = block;
+    cache->counts[c]++;
+}
+
+static void* GmpRealloc(void* ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return GmpAlloc(new_size);
+    BlockHeader* header = static_cast<BlockHeader*>(ptr) - 1;
+    size_t capacity = header->large ? header->size : (static_cast<size_t>(1) << (header->size + ALLOC_MIN_SHIFT));
+    capacity -= sizeof(BlockHeader);
+    // the block is big enough, and not much too big if it is large
+    if (new_size <= capacity && (new_size * 4 >= capacity || !header->large)) return ptr;
+
+    if (header->large && new_size + sizeof(BlockHeader) > (static_cast<size_t>(1) << ALLOC_MAX_SHIFT)) {
+        // move the pages instead of copying them
+        size_t old_length = header->size, length = LargeLength(new_size + sizeof(BlockHeader));
+        void* p = mremap(header, old_length, length, MREMAP_MAYMOVE);
+        if (p != MAP_FAILED) {
+            CountFree(old_length);
+            header = static_cast<BlockHeader*>(p);
+            if (huge_pages.load(std::memory_order_relaxed)) madvise(p, length, MADV_HUGEPAGE);
+            header->size = length;
+            CountAlloc(length, true);
+            return header + 1;
+        }
+    }
+
+    void* p = GmpAlloc(new_size);
+    memcpy(p, ptr, std::min(old_size, new_size));
+    GmpFree(ptr, old_size);
+
+    return p;
+}
+
+void InstallGmpAllocator(size_t cache_bytes) {
+    if (installed) return;
+    installed = true;
+    large_cache_limit = cache_bytes;
+    pthread_key_create(&thread_cache_key, ReleaseThreadCache);
+    mp_set_memory_functions(GmpAlloc, GmpRealloc, GmpFree);
+}
+
+bool GmpAllocatorInstalled() {
+    return installed;
+}
+
+AllocStats GetAllocStats() {
+    AllocStats stats;
+    stats.allocs = stat_allocs.load();
+    stats.bytes = stat_bytes.load();
+    stats.reused = stat_reused.load();
+    stats.in_use = stat_in_use.load();
+    stats.peak = stat_peak.load();
+
+    return stats;
+}
+
+void ResetAllocStats() {
+    stat_allocs = 0;
+    stat_bytes = 0;
+    stat_reused = 0;
+    stat_peak = stat_in_use.load();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Allocator for GMP limbs, installed through mp_set_memory_functions().
+ * Small blocks come from thread-local free lists of power of 2 size classes, so workers do not contend on malloc arenas.
+ * A block freed by another thread than the one which allocated it joins the free lists of the freeing thread.
+ * Large blocks are mmap'd, on transparent huge pages when available and pre-faulted otherwise,
+ * and are kept in a cache of up to cache_bytes when freed, so that the next product of about the same size
+ * reuses memory which is already faulted in. Large reallocs are done by mremap() instead of copying.
+ * It must be installed before GMP allocates anything, since it cannot free blocks of another allocator.
+ */
+struct AllocStats {
+    // number of blocks and bytes handed out, blocks taken from the free lists or the cache
+    size_t allocs, bytes, reused;
+    // bytes in use now, and at most since the last reset
+    size_t in_use, peak;
+};
+
+void InstallGmpAllocator(size_t cache_bytes);
+bool GmpAllocatorInstalled();
+AllocStats GetAllocStats();
+// counters start again from now, peak from the bytes in use now
+void ResetAllocStats();
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chudnovsky.hpp"
+
+/*
+ * Microbenchmarks of the building blocks of multi thread mode: ComputePQT() of fixed term ranges, the products of every merge level,
+ * the round-trips through the queues, the construction of the packs, the final stage and the binary to decimal conversion.
+ * Every benchmark runs once to warm up, then repeats times, and is reported with the median and the spread of its runs,
+ * as JSON on stdout so that the results can be kept, and as a table on stderr.
+ */
+using namespace std;
+
+struct BenchResult {
+    string name, args, unit;
+    vector<double> runs;
+    double median, min, max;
+};
+
+class ChudnovskyBench {
+    Chudnovsky& calc_;
+    int repeats_;
+    vector<BenchResult> results_;
+    volatile long sink_;
+
+    // one run is reported in ms, or in ns per operation if there are more than one
+    void Measure(const string& name, const string& args, long ops, const function<void()>& f);
+    // log2 of Q of the terms (n1, n2], the product of C^3/24 k^3
+    double QBits(int n1, int n2) const;
+
+public:
+    ChudnovskyBench(Chudnovsky& calc, int repeats): calc_(calc), repeats_(max(repeats, 1)), sink_(0) {}
+
+    void LeafRanges();
+    void MergeProducts();
+    void Queues();
+    void Packs();
+    void FinalStage();
+    void WriteJSON(ostream& os, const string& label) const;
+};
+
+void ChudnovskyBench::Measure(const string& name, const string& args, long ops, const function<void()>& f) {
+    BenchResult res = {name, args, ops > 1 ? "ns/op" : "ms", {}, 0, 0, 0};
+    f();
+    for (int i = 0; i < repeats_; i++) {
+        auto start = chrono::steady_clock::now();
+        f();
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        res.runs.push_back(ops > 1 ? ms * 1e6 / ops : ms);
+    }
+
+    vector<double> sorted = res.runs;
+    sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    res.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    res.min = sorted.front();
+    res.max = sorted.back();
+    cerr << " " << name << "\t" << args << "\t" << res.median << " " << res.unit << " (" << res.min << " - " << res.max << ")" << endl;
+    results_.push_back(res);
+}
+
+double ChudnovskyBench::QBits(int n1, int n2) const {
+    return (n2 - n1) * log2(calc_.C3_24_.get_d()) + 3 * (lgamma(n2 + 1.0) - lgamma(n1 + 1.0)) / log(2.0);
+}
+
+/*
+ * ComputePQT() of ranges at the start of the series and far in it, where the terms are larger.
+ */
+void ChudnovskyBench::LeafRanges() {
+    const int ranges[][2] = {{0, 32}, {0, 1024}, {0, 16384}, {100000, 101024}, {1000000, 1001024}};
+    for (auto& range: ranges) {
+        int n1 = range[0], n2 = range[1];
+        Measure("compute_pqt", to_string(n1) + "-" + to_string(n2), 1, [&]() {
+            NativePQT res = calc_.ComputePQT(n1, n2);
+            sink_ = mpz_size(res.T.get_mpz_t());
+        });
+    }
+}
+
+/*
+ * Multiply() of random operands of the size of the Q of the children of the last (largest) merge of every level,
+ * from the root down to operands of 2^14 bits.
+ */
+void ChudnovskyBench::MergeProducts() {
+    gmp_randclass rng(gmp_randinit_default);
+    rng.seed(1);
+    int n = calc_.N_;
+    for (int level = 0; (n >> (level + 1)) > 0; level++) {
+        int mid = n - (n >> (level + 1)), left = n - (n >> level);
+        long a_bits = QBits(left, mid), b_bits = QBits(mid, n);
+        if (min(a_bits, b_bits) < (1 << 14)) break;
+
+        mpz_class a = rng.get_z_bits(a_bits), b = rng.get_z_bits(b_bits), res;
+        Measure("merge_multiply", "level " + to_string(level) + ", " + to_string(a_bits) + " x " + to_string(b_bits) + " bits", 1, [&]() {
+            calc_.Multiply(res, a, b);
+        });
+    }
+}
+
+/*
+ * Round-trips of one pack at a time: between 2 threads through a request and a response PackQueue,
+ * and through the work-stealing scheduler to the workers of calc, as a combine of 1 limb operands.
+ */
+void ChudnovskyBench::Queues() {
+    const long trips = 100000;
+    for (QueueKind kind: {QUEUE_BOOST, QUEUE_LOCKFREE}) {
+        Measure("queue_roundtrip", kind == QUEUE_BOOST ? "boost" : "lockfree", trips, [&]() {
+            PackQueue<ReqPack> req_q(kind);
+            PackQueue<RespPack> resp_q(kind);
+            thread echo([&]() {
+                ReqPack req_pack;
+                for (long i = 0; i < trips; i++) {
+                    req_q.pull(req_pack);
+                    resp_q.push(RespPack(req_pack));
+                }
+            });
+            RespPack resp_pack;
+            for (long i = 0; i < trips; i++) {
+                req_q.push(ReqPack(i));
+                resp_q.pull(resp_pack);
+            }
+            echo.join();
+        });
+    }
+
+    mpz_class a = 3, b = 5, out;
+    Measure("worker_roundtrip", "combine, 1 limb", trips, [&]() {
+        RespPack resp_pack;
+        for (long i = 0; i < trips; i++) {
+            calc_.req_pack_q.push(ReqPack(i, &a, &b, &out));
+            calc_.comb_resp_pack_q.pull(resp_pack);
+        }
+    });
+}
+
+/*
+ * Construction and destruction of the packs of a combine and of a batch, which only point to their operands and PQT.
+ */
+void ChudnovskyBench::Packs() {
+    const long packs = 1000000;
+    mpz_class a = 3, b = 5, out;
+    Measure("pack_combine", "ReqPack + RespPack", packs, [&]() {
+        long sum = 0;
+        for (long i = 0; i < packs; i++) {
+            ReqPack req_pack(i, &a, &b, &out);
+            RespPack resp_pack(req_pack);
+            sum += resp_pack.GetID();
+        }
+        sink_ = sum;
+    });
+
+    PQT pqt;
+    Measure("pack_batch", "ReqPack + RespPack with PQT", packs, [&]() {
+        long sum = 0;
+        for (long i = 0; i < packs; i++) {
+            ReqPack req_pack(i, i, i + 1, &pqt);
+            RespPack resp_pack(req_pack, &pqt);
+            sum += resp_pack.GetN2();
+        }
+        sink_ = sum;
+    });
+}
+
+/*
+ * The final stage of the digits of calc, from its root computed once, with mpf, Newton reciprocal (-r) and fixed point (-f),
+ * then the binary to decimal conversion into memory.
+ */
+void ChudnovskyBench::FinalStage() {
+    NativePQT root = calc_.ComputePQT(0, calc_.N_);
+    PQT pqt;
+    pqt.P = &root.P;
+    pqt.Q = &root.Q;
+    pqt.T = &root.T;
+    string digits = to_string(calc_.DIGITS_) + " digits";
+    mpf_class pi(0, calc_.PREC_);
+    mpz_class pi_fixed;
+    long frac_bits = 0;
+
+    const pair<bool, bool> stages[] = {{false, false}, {true, false}, {false, true}};
+    const char* names[] = {"final_mpf", "final_newton", "final_fixed"};
+    for (int i = 0; i < 3; i++) {
+        calc_.NEWTON_DIVISION_ = stages[i].first;
+        calc_.FIXED_POINT_ = stages[i].second;
+        Measure(names[i], digits, 1, [&]() {
+            calc_.FinalStage(pqt, pi, pi_fixed, frac_bits);
+        });
+    }
+    calc_.NEWTON_DIVISION_ = false;
+    calc_.FIXED_POINT_ = false;
+
+    Measure("output_convert", digits, 1, [&]() {
+        shared_ptr<PiDigits> text;
+        calc_.WriteOutput("", pi_fixed, frac_bits, &text);
+        sink_ = text->Size();
+    });
+}
+
+static void WriteNumbers(ostream& os, const vector<double>& values) {
+    os << "[";
+    for (size_t i = 0; i < values.size(); i++) {
+        os << (i ? ", " : "") << values[i];
+    }
+    os << "]";
+}
+
+void ChudnovskyBench::WriteJSON(ostream& os, const string& label) const {
+    char date[32];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    os.precision(6);
+    os << "{\n  \"label\": \"" << label << "\",\n  \"date\": \"" << date << "\",\n  \"digits\": " << calc_.DIGITS_
+       << ",\n  \"workers\": " << calc_.NUM_OF_CORES_ << ",\n  \"repeats\": " << repeats_ << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results_.size(); i++) {
+        const BenchResult& res = results_[i];
+        os << "    {\"name\": \"" << res.name << "\", \"args\": \"" << res.args << "\", \"unit\": \"" << res.unit
+           << "\", \"median\": " << res.median << ", \"min\": " << res.min << ", \"max\": " << res.max
+           << ", \"spread\": " << (res.median > 0 ? (res.max - res.min) / res.median : 0) << ", \"runs\": ";
+        WriteNumbers(os, res.runs);
+        os << "}" << (i + 1 < results_.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}" << endl;
+}
+
+int main(int argc, char** argv) {
+    unordered_map<string, string> config = {{"digits", "1000000"}, {"worker", "-1"}, {"repeats", "5"}, {"label", ""}};
+    for (int i = 1; i < argc; i += 2) {
+        string para = i + 1 < argc ? argv[i] : "";
+        if (para == "-p") config["digits"] = argv[i + 1];
+        else if (para == "-w") config["worker"] = argv[i + 1];
+        else if (para == "-r") config["repeats"] = argv[i + 1];
+        else if (para == "-l") config["label"] = argv[i + 1];
+        else {
+            cerr << "usage: " << argv[0] << " [-p {digits}] [-w {workers}] [-r {repeats}] [-l {label}] > {file}.json" << endl;
+            return -1;
+        }
+    }
+
+    Chudnovsky calc(2, stoi(config["digits"]), stoi(config["worker"]));
+    ChudnovskyBench bench(calc, stoi(config["repeats"]));
+    cerr << " [*] Microbenchmarks, " << config["digits"] << " digits, median (min - max) of " << config["repeats"] << " runs" << endl;
+    bench.LeafRanges();
+    bench.MergeProducts();
+    bench.Queues();
+    bench.Packs();
+    bench.FinalStage();
+    bench.WriteJSON(cout, config["label"]);
+
+    return 0;
+}
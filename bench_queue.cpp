@@ -0,0 +1,60 @@
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "utils.hpp"
+#include "mpmc_queue.hpp"
+
+/*
+ * Microbenchmark of PackQueue<RespPack>: boost::sync_queue vs lock-free MPMCQueue.
+ * Half of the threads push RespPack carrying a PQT, the other half pull them.
+ */
+using namespace std;
+
+static double Run(QueueKind kind, int num_threads, int num_items) {
+    PackQueue<RespPack> q(kind);
+    PQT pqt;
+    int producers = max(num_threads / 2, 1), consumers = max(num_threads - producers, 1);
+    int per_producer = num_items / producers, per_consumer = per_producer * producers / consumers;
+    int rest = per_producer * producers - per_consumer * consumers;
+    vector<thread> threads;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < producers; i++) {
+        threads.emplace_back([&, i] {
+            for (int j = 0; j < per_producer; j++) {
+                q.push(RespPack(i * per_producer + j, j, j + 1, &pqt));
+            }
+        });
+    }
+    for (int i = 0; i < consumers; i++) {
+        threads.emplace_back([&, i] {
+            RespPack resp_pack;
+            int n = per_consumer + (i == 0 ? rest : 0);
+            for (int j = 0; j < n; j++) {
+                q.pull(resp_pack);
+            }
+        });
+    }
+    for (auto& t: threads) {
+        t.join();
+    }
+    auto ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    return per_producer * producers / ms / 1000.0;
+}
+
+int main(int argc, char** argv) {
+    int num_items = argc > 1 ? stoi(argv[1]) : 1000000;
+
+    cerr << " [*] " << num_items << " RespPack per run, Mops/s" << endl;
+    cerr << " threads\tboost\tlockfree" << endl;
+    for (int num_threads = 2; num_threads <= 64; num_threads <<= 1) {
+        double boost_ops = Run(QUEUE_BOOST, num_threads, num_items);
+        double lockfree_ops = Run(QUEUE_LOCKFREE, num_threads, num_items);
+        cerr << " " << num_threads << "\t\t" << boost_ops << "\t" << lockfree_ops << endl;
+    }
+
+    return 0;
+}
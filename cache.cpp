@@ -0,0 +1,215 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+
+// FNV-1a, the key is kept in the entry, so a collision is only a miss
+static uint64_t HashKey(const std::string& key) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c: key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// one integer of the GMP raw export format at p, whose end is end: 4 bytes of signed size, big endian, then the bytes
+static const unsigned char* ImportRaw(mpz_class& z, const unsigned char* p, const unsigned char* end) {
+    if (end - p < 4) return nullptr;
+    int32_t size = static_cast<int32_t>((static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+    p += 4;
+    size_t bytes = size < 0 ? -static_cast<int64_t>(size) : size;
+    if (static_cast<size_t>(end - p) < bytes) return nullptr;
+    mpz_import(z.get_mpz_t(), bytes, 1, 1, 1, 0, p);
+    if (size < 0) mpz_neg(z.get_mpz_t(), z.get_mpz_t());
+
+    return p + bytes;
+}
+
+PQTCache::PQTCache(const std::string& dir, const std::string& constants, size_t budget):
+    dir_(dir), constants_(constants), budget_(budget), bytes_(0), tick_(0), hits_(0), misses_(0), stored_(0), evicted_(0) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+
+    FILE* fp = fopen((dir_ + "/index").c_str(), "r");
+    if (fp) {
+        uint64_t hash, last_use;
+        size_t bytes;
+        while (fscanf(fp, "%" SCNx64 " %zu %" SCNu64, &hash, &bytes, &last_use) == 3) {
+            if (!std::filesystem::exists(Path(hash), ec)) continue;
+            index_[hash] = {bytes, last_use};
+            bytes_ += bytes;
+            tick_ = std::max(tick_, last_use);
+        }
+        fclose(fp);
+    }
+    // the leftovers of an interrupted write, and files the index does not know, are not accounted in the budget
+    if (budget_ == 0) return;
+    for (const auto& file: std::filesystem::directory_iterator(dir_, ec)) {
+        uint64_t hash;
+        std::string name = file.path().filename().string();
+        if (name == "index") continue;
+        if (name.size() == 20 && name.compare(16, 4, ".pqt") == 0 && sscanf(name.c_str(), "%16" SCNx64, &hash) == 1 && index_.count(hash)) continue;
+        std::filesystem::remove(file.path(), ec);
+    }
+    // the budget may be smaller than in the last run
+    std::lock_guard<std::mutex> lock(mtx_);
+    Evict(0);
+}
+
+PQTCache::~PQTCache() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    WriteIndex();
+}
+
+std::string PQTCache::Key(int n1, int n2) const {
+    return constants_ + ":" + std::to_string(n1) + ":" + std::to_string(n2);
+}
+
+std::string PQTCache::Path(uint64_t hash) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".pqt", hash);
+
+    return dir_ + name;
+}
+
+bool PQTCache::Read(const std::string& path, const std::string& key, NativePQT& res) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const unsigned char* p = static_cast<const unsigned char*>(map);
+    const unsigned char* end = p + st.st_size;
+    uint32_t key_len = 0;
+    bool ok = static_cast<size_t>(end - p) >= sizeof(key_len);
+    if (ok) {
+        memcpy(&key_len, p, sizeof(key_len));
+        p += sizeof(key_len);
+        ok = static_cast<size_t>(end - p) >= key_len && key.compare(0, std::string::npos, reinterpret_cast<const char*>(p), key_len) == 0;
+        p += ok ? key_len : 0;
+    }
+    if (ok) p = ImportRaw(res.P, p, end);
+    if (ok && p) p = ImportRaw(res.Q, p, end);
+    if (ok && p) p = ImportRaw(res.T, p, end);
+    munmap(map, st.st_size);
+
+    return ok && p == end;
+}
+
+bool PQTCache::Lookup(int n1, int n2, NativePQT& res) {
+    std::string key = Key(n1, n2);
+    uint64_t hash = HashKey(key);
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = index_.find(hash);
+        if (it == index_.end()) {
+            misses_++;
+            return false;
+        }
+        it->second.last_use = ++tick_;
+    }
+
+    if (Read(Path(hash), key, res)) {
+        hits_++;
+        return true;
+    }
+    misses_++;
+
+    // a broken entry, or another key with the same hash, is dropped so that the batch can be stored again
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = index_.find(hash);
+    if (it != index_.end()) {
+        remove(Path(hash).c_str());
+        bytes_ -= it->second.bytes;
+        index_.erase(it);
+    }
+
+    return false;
+}
+
+void PQTCache::Store(int n1, int n2, const NativePQT& res) {
+    if (budget_ == 0) return;
+    std::string key = Key(n1, n2);
+    uint64_t hash = HashKey(key);
+    // another process may store the same entry
+    std::string path = Path(hash), tmp = path + ".tmp" + std::to_string(getpid());
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (index_.count(hash)) return;
+    }
+
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return;
+    uint32_t key_len = key.size();
+    bool ok = fwrite(&key_len, sizeof(key_len), 1, fp) == 1 && fwrite(key.data(), 1, key_len, fp) == key_len;
+    ok = ok && mpz_out_raw(fp, res.P.get_mpz_t()) > 0;
+    ok = ok && mpz_out_raw(fp, res.Q.get_mpz_t()) > 0;
+    ok = ok && mpz_out_raw(fp, res.T.get_mpz_t()) > 0;
+    long bytes = ok ? ftell(fp) : -1;
+    ok = (fclose(fp) == 0) && ok && bytes > 0;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (index_.count(hash)) return;
+    index_[hash] = {static_cast<size_t>(bytes), ++tick_};
+    bytes_ += bytes;
+    stored_++;
+    Evict(hash);
+}
+
+/*
+ * Drop the least recently used entries until the cache fits in the budget. The new entry keep, if any, goes last,
+ * i.e. only when it is larger than the budget by itself. Called with mtx_ held.
+ */
+void PQTCache::Evict(uint64_t keep) {
+    while (bytes_ > budget_ && !index_.empty()) {
+        auto victim = index_.end();
+        for (auto it = index_.begin(); it != index_.end(); it++) {
+            if (it->first == keep && index_.size() > 1) continue;
+            if (victim == index_.end() || it->second.last_use < victim->second.last_use) victim = it;
+        }
+        remove(Path(victim->first).c_str());
+        bytes_ -= victim->second.bytes;
+        index_.erase(victim);
+        evicted_++;
+    }
+}
+
+// called with mtx_ held
+void PQTCache::WriteIndex() {
+    // the last uses of the hits are kept for the next runs too, even if the cache is read-only
+    if (hits_ == 0 && stored_ == 0 && evicted_ == 0) return;
+    std::string path = dir_ + "/index", tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (!fp) return;
+    bool ok = true;
+    for (const auto& entry: index_) {
+        ok = ok && fprintf(fp, "%016" PRIx64 " %zu %" PRIu64 "\n", entry.first, entry.second.bytes, entry.second.last_use) > 0;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) remove(tmp.c_str());
+}
+
+PQTCache::Stats PQTCache::GetStats() {
+    std::lock_guard<std::mutex> lock(mtx_);
+
+    return {hits_.load(), misses_.load(), stored_.load(), evicted_.load(), bytes_};
+}
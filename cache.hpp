@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "utils.hpp"
+
+/*
+ * Persistent cache of the P, Q, T of batches, for the runs which compute the same ranges of terms again.
+ * An entry is content-addressed by a hash of its key, made of the constants of the series, n1 and n2:
+ * dir/{hash}.pqt holds the key, then P, Q and T in GMP raw export format, and is read back through mmap.
+ * dir/index lists the entries with their size and last use, so the least recently used ones are evicted
+ * when a new entry does not fit in the size budget. Files are written aside and renamed.
+ */
+class PQTCache {
+public:
+    struct Stats {
+        size_t hits, misses, stored, evicted, bytes;
+    };
+
+private:
+    struct Entry {
+        size_t bytes;
+        uint64_t last_use;
+    };
+
+    std::string dir_, constants_;
+    // 0 to only read the cache
+    size_t budget_, bytes_;
+    uint64_t tick_;
+    std::unordered_map<uint64_t, Entry> index_;
+    std::mutex mtx_;
+    std::atomic<size_t> hits_, misses_, stored_, evicted_;
+
+    std::string Key(int n1, int n2) const;
+    std::string Path(uint64_t hash) const;
+    bool Read(const std::string& path, const std::string& key, NativePQT& res);
+    void Evict(uint64_t keep);
+    void WriteIndex();
+
+public:
+    // constants: whatever changes P, Q, T of the same terms, budget: bytes kept on disk when filling the cache
+    PQTCache(const std::string& dir, const std::string& constants, size_t budget);
+    // the index is written back
+    ~PQTCache();
+    PQTCache(const PQTCache&) = delete;
+    PQTCache& operator=(const PQTCache&) = delete;
+
+    // P, Q, T of the terms (n1, n2] if they are cached, thread-safe
+    bool Lookup(int n1, int n2, NativePQT& res);
+    // add them to the cache, unless it is read-only, thread-safe
+    void Store(int n1, int n2, const NativePQT& res);
+    Stats GetStats();
+};
@@ -0,0 +1,216 @@
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.hpp"
+
+static const int CHECKPOINT_MAGIC = 0x33545150; // "PQT3"
+static const int ROOT_MAGIC = 0x544f4f52; // "ROOT"
+
+Checkpoint::Checkpoint(const std::string& dir, int digits, int batch_num, bool resume):
+    dir_(dir), digits_(digits), batch_num_(batch_num), stop_(false) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+
+    for (const auto& file: std::filesystem::directory_iterator(dir_, ec)) {
+        int level_size, id;
+        std::string name = file.path().filename().string();
+        if (sscanf(name.c_str(), "pqt_%d_%d", &level_size, &id) != 2) continue;
+        // a .tmp file is the leftover of an interrupted write
+        if (resume && name == "pqt_" + std::to_string(level_size) + "_" + std::to_string(id) + ".bin") saved_[level_size].insert(id);
+        else std::filesystem::remove(file.path(), ec);
+    }
+
+    thread_ = std::thread(&Checkpoint::WriterThread, this);
+}
+
+Checkpoint::~Checkpoint() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+}
+
+std::string Checkpoint::Path(int level_size, int id) const {
+    return dir_ + "/pqt_" + std::to_string(level_size) + "_" + std::to_string(id) + ".bin";
+}
+
+bool Checkpoint::Write(const Task& task) {
+    std::string path = Path(task.level_size, task.id), tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return false;
+
+    int header[8] = {CHECKPOINT_MAGIC, digits_, batch_num_, task.level_size, task.id, task.n1, task.n2, sgn(*task.pqt->P) != 0};
+    bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+    ok = ok && fwrite(task.pqt->err.data(), sizeof(double), 3, fp) == 3;
+    ok = ok && mpz_out_raw(fp, task.pqt->P->get_mpz_t()) > 0;
+    ok = ok && mpz_out_raw(fp, task.pqt->Q->get_mpz_t()) > 0;
+    ok = ok && mpz_out_raw(fp, task.pqt->T->get_mpz_t()) > 0;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool Checkpoint::Read(const std::string& path, int level_size, int id, int& n1, int& n2, bool& has_p, PQT& pqt) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) return false;
+
+    int header[8];
+    bool ok = fread(header, sizeof(header), 1, fp) == 1;
+    // a file of another run, e.g. with other digits or workers, does not fit in this merge tree
+    ok = ok && header[0] == CHECKPOINT_MAGIC && header[1] == digits_ && header[2] == batch_num_ && header[3] == level_size && header[4] == id;
+    ok = ok && fread(pqt.err.data(), sizeof(double), 3, fp) == 3;
+    ok = ok && mpz_inp_raw(pqt.P->get_mpz_t(), fp) > 0;
+    ok = ok && mpz_inp_raw(pqt.Q->get_mpz_t(), fp) > 0;
+    ok = ok && mpz_inp_raw(pqt.T->get_mpz_t(), fp) > 0;
+    fclose(fp);
+    n1 = header[5];
+    n2 = header[6];
+    has_p = header[7] != 0;
+
+    return ok;
+}
+
+void Checkpoint::WriterThread() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (true) {
+        cv_.wait(lock, [this] {return stop_ || !tasks_.empty();});
+        if (tasks_.empty()) return;
+
+        Task task = tasks_.front();
+        lock.unlock();
+        bool ok = Write(task);
+        lock.lock();
+        tasks_.pop_front();
+        pending_.erase(pending_.find(task.pqt));
+
+        if (ok) {
+            std::set<int>& level = saved_[task.level_size];
+            level.insert(task.id);
+            // the whole level is on disk, the levels below are not needed anymore
+            if (static_cast<int>(level.size()) == task.level_size) {
+                std::vector<std::string> paths;
+                for (auto it = saved_.upper_bound(task.level_size); it != saved_.end(); it = saved_.erase(it)) {
+                    for (int id: it->second) {
+                        paths.push_back(Path(it->first, id));
+                    }
+                }
+                lock.unlock();
+                for (const std::string& path: paths) {
+                    remove(path.c_str());
+                }
+                lock.lock();
+            }
+        }
+        cv_.notify_all();
+    }
+}
+
+int Checkpoint::Load(std::vector<RespPack>& finished, bool need_p, const std::function<PQT*(int level_size, int id)>& slot) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    int level_size = batch_num_;
+    // the highest complete level, otherwise the leaves which are there
+    for (auto& level: saved_) {
+        if (static_cast<int>(level.second.size()) == level.first) {
+            level_size = level.first;
+            break;
+        }
+    }
+
+    std::set<int> ids = saved_[level_size];
+    int without_p = 0;
+    for (int id: ids) {
+        int n1, n2;
+        bool has_p;
+        PQT* pqt = slot(level_size, id);
+        bool ok = Read(Path(level_size, id), level_size, id, n1, n2, has_p, *pqt);
+        if (ok && need_p && !has_p) without_p++;
+        // erased, so that the subtree computed again is saved
+        if (!ok || (need_p && !has_p)) {
+            saved_[level_size].erase(id);
+            continue;
+        }
+        finished.emplace_back(id, n1, n2, pqt);
+    }
+    if (without_p > 0) std::cerr << " [*] " << without_p << " subtrees of the checkpoint were saved without P, which -save needs, they are computed again from their batches" << std::endl;
+
+    // a broken file makes the level incomplete, then start again from the leaves, as when nothing but subtrees without P is left
+    if (level_size != batch_num_ && (finished.empty() || static_cast<int>(finished.size()) + without_p != level_size)) {
+        finished.clear();
+        return batch_num_;
+    }
+
+    return level_size;
+}
+
+void Checkpoint::Save(int level_size, int id, int n1, int n2, PQT* pqt) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (saved_.count(level_size) && saved_[level_size].count(id)) return;
+
+    tasks_.push_back({level_size, id, n1, n2, pqt});
+    pending_.insert(pqt);
+    cv_.notify_all();
+}
+
+void Checkpoint::WaitWritten(PQT* pqt) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [&] {return pending_.count(pqt) == 0;});
+}
+
+bool Checkpoint::IsPending(PQT* pqt) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return pending_.count(pqt) > 0;
+}
+
+void Checkpoint::Flush() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [this] {return tasks_.empty();});
+}
+
+bool SaveRoot(const std::string& path, int n, const PQT& pqt) {
+    if (sgn(*pqt.P) == 0) return false;
+
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (!fp) return false;
+
+    int header[2] = {ROOT_MAGIC, n};
+    bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+    ok = ok && mpz_out_raw(fp, pqt.P->get_mpz_t()) > 0;
+    ok = ok && mpz_out_raw(fp, pqt.Q->get_mpz_t()) > 0;
+    ok = ok && mpz_out_raw(fp, pqt.T->get_mpz_t()) > 0;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool LoadRoot(const std::string& path, int& n, PQT& pqt) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) return false;
+
+    int header[2];
+    bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == ROOT_MAGIC && header[1] > 0;
+    ok = ok && mpz_inp_raw(pqt.P->get_mpz_t(), fp) > 0;
+    ok = ok && mpz_inp_raw(pqt.Q->get_mpz_t(), fp) > 0;
+    ok = ok && mpz_inp_raw(pqt.T->get_mpz_t(), fp) > 0;
+    // P of the root of a run is only computed when it is saved, it is never 0 then
+    ok = ok && sgn(*pqt.P) != 0;
+    fclose(fp);
+    n = header[1];
+
+    return ok;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+/*
+ * Checkpoint of the finished subtrees of the merge tree, for resuming a long run.
+ * A subtree is identified by the size of its merge level and its index in it: every level has half of the subtrees
+ * of the level below, rounded up, so the level size alone tells which batches it covers.
+ * Every subtree is written by a background thread to dir/pqt_{level_size}_{id}.bin: a header (digits, batch num,
+ * level size, id, n1, n2, whether P was multiplied), the error bounds of the truncated mode, then P, Q and T in GMP raw export format.
+ * P of the right spine is only multiplied when the root is saved, so a run with -save computes these subtrees again.
+ * The file is written aside and renamed, so it is either complete or missing. Once a whole level is on disk, the files of the level below are removed.
+ * On resume, the highest complete level is reloaded, or else the finished leaves.
+ */
+class Checkpoint {
+    struct Task {
+        int level_size, id, n1, n2;
+        PQT* pqt;
+    };
+
+    std::string dir_;
+    int digits_, batch_num_;
+    // subtrees on disk, per level size
+    std::map<int, std::set<int>> saved_;
+    // subtrees queued or being written, once per level a carried subtree is saved on
+    std::multiset<PQT*> pending_;
+
+    std::thread thread_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<Task> tasks_;
+    bool stop_;
+
+    std::string Path(int level_size, int id) const;
+    bool Write(const Task& task);
+    bool Read(const std::string& path, int level_size, int id, int& n1, int& n2, bool& has_p, PQT& pqt);
+    void WriterThread();
+
+public:
+    // resume: keep the files already in dir, otherwise they are removed
+    Checkpoint(const std::string& dir, int digits, int batch_num, bool resume);
+    ~Checkpoint();
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    // finished subtrees to restart from, read into the PQT given by slot, returns the size of the level they belong to
+    // need_p: the subtrees saved without P are left out, for the caller to compute again, the level is still returned
+    int Load(std::vector<RespPack>& finished, bool need_p, const std::function<PQT*(int level_size, int id)>& slot);
+    // queue a finished subtree, nothing is done if it is already on disk, pqt must stay until it is written
+    void Save(int level_size, int id, int n1, int n2, PQT* pqt);
+    // wait until pqt is written, if it is queued
+    void WaitWritten(PQT* pqt);
+    // pqt is queued or being written
+    bool IsPending(PQT* pqt);
+    // wait until everything queued is written
+    void Flush();
+};
+
+/*
+ * Root of a finished run, P, Q and T of the terms [0, n), for a later run with more digits to extend:
+ * a header (magic, n), then P, Q and T in GMP raw export format, written aside and renamed.
+ * A root without P cannot be extended, so it is not saved.
+ */
+bool SaveRoot(const std::string& path, int n, const PQT& pqt);
+bool LoadRoot(const std::string& path, int& n, PQT& pqt);
@@ -1,9 +1,46 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+
 #include "chudnovsky.hpp"
 
-Chudnovsky::Chudnovsky(int version, int digits, int worker_num): terminated(false), debug(false) {
+static int GetNumOfCores(int worker_num) {
+    return worker_num <= 0 ? std::thread::hardware_concurrency() : worker_num;
+}
+
+// a task of a worker for the trace, pulled at begin
+static TraceEvent TaskEvent(ReqPack& req_pack, int64_t begin) {
+    static const char* names[] = {"unknown", "minimal", "compute", "combine", "combine2", "convert"};
+    PackType type = req_pack.GetType();
+    TraceEvent event = {names[type], "task", begin, begin, req_pack.GetQueued() >= 0 ? begin - req_pack.GetQueued() : -1, req_pack.GetID(), 0, 0, 0, 0};
+    if (type == TYPE_COMPUTE || type == TYPE_CONVERT) {
+        event.n1 = req_pack.GetN1();
+        event.n2 = req_pack.GetN2();
+    } else if (type == TYPE_COMBINE && req_pack.Getpa()) {
+        event.a_bits = mpz_sizeinbase(req_pack.Getpa()->get_mpz_t(), 2);
+        event.b_bits = mpz_sizeinbase(req_pack.Getpb()->get_mpz_t(), 2);
+    } else if (type == TYPE_COMBINE2) {
+        event.a_bits = mpz_sizeinbase(req_pack.GetPQT()->T->get_mpz_t(), 2);
+        event.b_bits = mpz_sizeinbase(req_pack.Getpa()->get_mpz_t(), 2);
+    }
+
+    return event;
+}
+
+static void PrintAllocStats() {
+    if (!GmpAllocatorInstalled()) return;
+    AllocStats stats = GetAllocStats();
+    std::cerr << " [*] Allocator: blocks = " << stats.allocs << ", reused = " << stats.reused << ", allocated(MB) = " << (stats.bytes >> 20)
+              << ", peak(MB) = " << (stats.peak >> 20) << std::endl;
+}
+
+Chudnovsky::Chudnovsky(int version, int digits, int worker_num, QueueKind queue_kind):
+    terminated(false), cancelled_(false), debug(false), NTT_THRESHOLD_(1 << 19), NEWTON_DIVISION_(false), FIXED_POINT_(false), FACTOR_REMOVAL_(false), NEED_ROOT_P_(false), FIRST_TERM_(0), base_(nullptr), TRUNCATE_(false), TRUNCATE_BITS_(0), HEX_TAIL_(0), SPILL_BUDGET_(0), RESUME_(false), CACHE_BUDGET_(0), MODCHECK_PRIMES_(0), finished_subtrees_(0), total_subtrees_(1), req_pack_q(GetNumOfCores(worker_num)),
+    comb_resp_pack_q(queue_kind), comp_resp_pack_q(queue_kind), comp2_resp_pack_q(queue_kind), final_req_pack_q(queue_kind), final_resp_pack_q(queue_kind),
+    out_resp_pack_q(queue_kind), out_buf_(nullptr), out_int_len_(0), CONVERT_TASK_DIGITS_(0) {
     VERSION_ = version;
     // constants for Chudnovsky Algorithm
-    DIGITS_ = std::max(digits, 0);
     A_ = 13591409;
     B_ = 545140134;
     C_ = 640320;
@@ -12,16 +49,15 @@ Chudnovsky::Chudnovsky(int version, int digits, int worker_num): terminated(fals
     // = log(53360^3) / log(10)
     DIGITS_PER_TERM_ = 14.1816474627254776555;
     C3_24_ = C_ * C_ * C_ / 24;
-    N_ = std::max(DIGITS_PER_TERM_, static_cast<double>(DIGITS_)) / DIGITS_PER_TERM_;
-    PREC_ = std::max(0, DIGITS_) * log2(10);
+    SetDigits(digits);
 
     // for concurrency
     int cpu_no = 0;
 
-    NUM_OF_CORES_ = worker_num <= 0 ? std::thread::hardware_concurrency() : worker_num;
+    NUM_OF_CORES_ = GetNumOfCores(worker_num);
     pqt_workers = std::vector<std::thread>(std::max(NUM_OF_CORES_, 1));
     for (auto& pqt_worker: pqt_workers) {
-        pqt_worker = std::thread(&Chudnovsky::PQTWorkerV1, this);
+        pqt_worker = std::thread(&Chudnovsky::PQTWorkerV1, this, cpu_no);
         SetCpuAffinity((cpu_no++)%NUM_OF_CORES_, pqt_worker);
     }
     SetCpuAffinity((cpu_no++)%NUM_OF_CORES_);
@@ -51,6 +87,370 @@ void Chudnovsky::Stop() {
     pi_worker.join();
 }
 
+void Chudnovsky::SetNTTThreshold(long limbs) {
+    NTT_THRESHOLD_ = std::max(limbs, 0L);
+}
+
+void Chudnovsky::SetNewtonDivision(bool enabled) {
+    NEWTON_DIVISION_ = enabled;
+}
+
+void Chudnovsky::SetFixedPoint(bool enabled) {
+    FIXED_POINT_ = enabled;
+}
+
+void Chudnovsky::SetFactorRemoval(bool enabled) {
+    FACTOR_REMOVAL_ = enabled;
+}
+
+void Chudnovsky::SetTruncate(bool enabled) {
+    TRUNCATE_ = enabled;
+}
+
+void Chudnovsky::SetHexTail(long count) {
+    HEX_TAIL_ = std::max(count, 0L);
+}
+
+void Chudnovsky::SetModCheck(int primes) {
+    MODCHECK_PRIMES_ = std::max(primes, 0);
+}
+
+void Chudnovsky::SetSaveRoot(const std::string& path) {
+    SAVE_ROOT_ = path;
+    NEED_ROOT_P_ = !path.empty();
+}
+
+void Chudnovsky::SetExtendRoot(const std::string& path) {
+    EXTEND_ROOT_ = path;
+}
+
+void Chudnovsky::SetDigits(int digits) {
+    DIGITS_ = std::max(digits, 0);
+    N_ = std::max(DIGITS_PER_TERM_, static_cast<double>(DIGITS_)) / DIGITS_PER_TERM_;
+    PREC_ = DIGITS_ * log2(10);
+}
+
+void Chudnovsky::SetVersion(int version) {
+    VERSION_ = version;
+}
+
+void Chudnovsky::SetProgress(const std::function<void(const std::string&, double)>& progress) {
+    progress_ = progress;
+}
+
+void Chudnovsky::SetCancelled(bool cancelled) {
+    cancelled_ = cancelled;
+}
+
+void Chudnovsky::SetCache(const std::string& dir, long budget_mb) {
+    CACHE_DIR_ = dir;
+    CACHE_BUDGET_ = std::max(budget_mb, 0L) << 20;
+}
+
+void Chudnovsky::SetSpill(long budget_mb, const std::vector<std::string>& dirs) {
+    SPILL_BUDGET_ = std::max(budget_mb, 0L) << 20;
+    SPILL_DIRS_ = dirs.empty() ? std::vector<std::string>(1, ".") : dirs;
+}
+
+void Chudnovsky::SetCheckpoint(const std::string& dir, bool resume) {
+    CHECKPOINT_DIR_ = dir;
+    RESUME_ = resume;
+}
+
+/*
+ * Estimated work of ComputePQT(n1, n2): the integers it produces have about bits bits, which are multiplied
+ * on every level of its tree. The terms of P and Q grow like 72 k^3 and C^3/24 k^3, so later terms cost more.
+ */
+double Chudnovsky::BatchCost(int n1, int n2) {
+    if (n2 <= n1) return 0;
+    // log2((n2)! / (n1)!), the sum of log2(k) over the terms
+    double log2_k = (std::lgamma(n2 + 1.0) - std::lgamma(n1 + 1.0)) / M_LN2;
+    double bits = (n2 - n1) * (log2(72.0) + log2(C3_24_.get_d())) + 6 * log2_k;
+
+    return bits * log2(bits + 2) * log2(n2 - n1 + 1.0);
+}
+
+/*
+ * Split [FIRST_TERM_, N_) into BATCH_NUM_ batches of about the same cost, so that every worker finishes its leaves at about the same time.
+ * The cost is not additive, so the batches are cut greedily from the left under a cost limit,
+ * which is bisected until the last batch costs the same as the others.
+ */
+void Chudnovsky::PartitionBatches() {
+    BATCH_NUM_ = std::max(std::min(NUM_OF_CORES_ * 8, N_ - FIRST_TERM_), 1);
+    BATCH_BOUNDS_.assign(BATCH_NUM_ + 1, FIRST_TERM_);
+    BATCH_BOUNDS_[BATCH_NUM_] = N_;
+
+    // cut with the limit, and return the cost of the last batch
+    auto cut = [this](double limit) {
+        for (int i = 0; i < BATCH_NUM_ - 1; i++) {
+            // every batch keeps at least 1 term
+            int lo = BATCH_BOUNDS_[i] + 1, hi = N_ - (BATCH_NUM_ - 1 - i);
+            while (lo < hi) {
+                int mid = lo + (hi - lo + 1) / 2;
+                if (BatchCost(BATCH_BOUNDS_[i], mid) <= limit) lo = mid;
+                else hi = mid - 1;
+            }
+            BATCH_BOUNDS_[i+1] = lo;
+        }
+
+        return BatchCost(BATCH_BOUNDS_[BATCH_NUM_-1], N_);
+    };
+
+    double lo = 0, hi = BatchCost(FIRST_TERM_, N_);
+    for (int i = 0; i < 64 && hi - lo > 1e-9 * hi; i++) {
+        double mid = (lo + hi) / 2;
+        if (cut(mid) > mid) lo = mid;
+        else hi = mid;
+    }
+    cut(hi);
+}
+
+/*
+ * The finished subtrees of the checkpoint when resuming, and the size of the level they belong to.
+ */
+size_t Chudnovsky::LoadCheckpoint(std::vector<RespPack>& finished) {
+    size_t level_size = BATCH_NUM_;
+    if (checkpoint_ && RESUME_) level_size = checkpoint_->Load(finished, NEED_ROOT_P_, [this](int level_size, int id) {return SubtreePQT(level_size, id);});
+    // the subtrees of a run over other terms, e.g. extending another root, do not fit in this merge tree
+    for (auto& resp_pack: finished) {
+        int n1, n2;
+        SubtreeRange(level_size, resp_pack.GetID(), n1, n2);
+        if (resp_pack.GetN1() == n1 && resp_pack.GetN2() == n2) continue;
+        finished.clear();
+        level_size = BATCH_NUM_;
+        break;
+    }
+    if (!finished.empty()) {
+        std::cerr << " [*] Resume from " << finished.size() << " of " << level_size << " subtrees" << std::endl;
+    }
+    for (auto& resp_pack: finished) {
+        if (modcheck_) modcheck_->Of(*resp_pack.GetResult(), resp_pack.GetResult()->mod);
+    }
+
+    // the subtrees left out by the checkpoint, e.g. saved without P, are computed again from their batches
+    if (level_size == BATCH_NUM_) return level_size;
+    std::vector<bool> loaded(level_size, false);
+    for (auto& resp_pack: finished) {
+        loaded[resp_pack.GetID()] = true;
+    }
+    for (size_t i = 0; i < level_size; i++) {
+        if (!loaded[i]) finished.push_back(ComputeSubtree(level_size, i));
+    }
+
+    return level_size;
+}
+
+/*
+ * The subtree at index id in a level of level_size, computed from its batches before the merge starts:
+ * the workers compute the batches, then master merges them level by level into the nodes of the subtree,
+ * as the merge of the whole tree would.
+ */
+RespPack Chudnovsky::ComputeSubtree(size_t level_size, int id) {
+    long span = 1;
+    for (size_t size = BATCH_NUM_; size > level_size; size = (size + 1) >> 1) {
+        span <<= 1;
+    }
+    int lo = std::min<long>(id * span, BATCH_NUM_), hi = std::min<long>((id + 1) * span, BATCH_NUM_);
+    for (int i = lo; i < hi; i++) {
+        req_pack_q.push(ReqPack(i, BATCH_BOUNDS_[i], BATCH_BOUNDS_[i+1], SubtreePQT(BATCH_NUM_, i)));
+    }
+
+    // version 4 waits for all of its tasks on one queue
+    std::vector<RespPack> resp_packs(hi - lo);
+    for (int i = lo; i < hi; i++) {
+        RespPack resp_pack;
+        if (VERSION_ == 4) comb_resp_pack_q.pull(resp_pack);
+        else comp_resp_pack_q.pull(resp_pack);
+        resp_packs[resp_pack.GetID() - lo] = std::move(resp_pack);
+    }
+
+    // the ids of resp_packs are lo, lo + 1, ... in a level of size, the last of an odd level is carried up
+    for (size_t size = BATCH_NUM_; size > level_size; size = (size + 1) >> 1) {
+        size_t parent_size = (size + 1) >> 1;
+        std::vector<RespPack> parents((resp_packs.size() + 1) >> 1);
+        for (size_t i = 0; i < resp_packs.size(); i += 2) {
+            if (i + 1 == resp_packs.size()) {
+                RespPack carried(resp_packs[i].GetID() / 2, resp_packs[i].GetN1(), resp_packs[i].GetN2(), resp_packs[i].TakeResult());
+                resp_packs[i].Invalidate();
+                parents[i/2] = std::move(carried);
+            } else {
+                int parent_id = resp_packs[i].GetID() / 2;
+                parents[i/2] = CombinePQTMasterV1(resp_packs[i], resp_packs[i+1], true, SubtreePQT(parent_size, parent_id));
+            }
+        }
+        resp_packs = std::move(parents);
+    }
+
+    return std::move(resp_packs[0]);
+}
+
+/*
+ * Send the batches of the leaves to the workers, and return the size of the level the master starts from.
+ * When resuming, the finished subtrees of the checkpoint are sent to master as if workers had just computed them,
+ * and only the missing leaves are computed.
+ */
+size_t Chudnovsky::SendBatches() {
+    std::vector<RespPack> finished;
+    size_t level_size = LoadCheckpoint(finished);
+
+    std::vector<bool> done(level_size, false);
+    for (auto& resp_pack: finished) {
+        done[resp_pack.GetID()] = true;
+        comp_resp_pack_q.push(std::move(resp_pack));
+    }
+
+    // pack the request
+    for (int i = 0; i < BATCH_NUM_; i++) {
+        if (level_size == BATCH_NUM_ && !done[i]) req_pack_q.push(ReqPack(i, BATCH_BOUNDS_[i], BATCH_BOUNDS_[i+1], SubtreePQT(BATCH_NUM_, i)));
+    }
+
+    return level_size;
+}
+
+/*
+ * Terms [n1, n2) of the subtree at index id in a level of level_size, and its merge order.
+ * Every level has half of the subtrees of the level below, rounded up, so a subtree covers the batches
+ * [index * span, (index + 1) * span), cut at BATCH_NUM_, where span is 2^(levels below).
+ * Merges are done level by level, in index order, so its merge order is the number of subtrees of the levels below
+ * plus index.
+ */
+long Chudnovsky::SubtreeRange(size_t level_size, int id, int& n1, int& n2) {
+    long span = 1, order = id;
+    for (size_t size = BATCH_NUM_; size > level_size; size = (size + 1) >> 1) {
+        span <<= 1;
+        order += size;
+    }
+    n1 = BATCH_BOUNDS_[std::min<long>(id * span, BATCH_NUM_)];
+    n2 = BATCH_BOUNDS_[std::min<long>((id + 1) * span, BATCH_NUM_)];
+
+    return order;
+}
+
+/*
+ * The node of the pool of the subtree at index id in a level of level_size, which is its merge order.
+ */
+PQT* Chudnovsky::SubtreePQT(size_t level_size, int id) {
+    int n1, n2;
+    return pool_.Node(SubtreeRange(level_size, id, n1, n2));
+}
+
+/*
+ * The children of a merge are not read anymore once its products are done, so their limbs are freed,
+ * or by a later call once the checkpoint has written them. nullptr only frees those.
+ */
+void Chudnovsky::ReleasePQT(PQT* pqt) {
+    if (pqt) unreleased_.push_back(pqt);
+    for (size_t i = 0; i < unreleased_.size(); ) {
+        if (checkpoint_ && checkpoint_->IsPending(unreleased_[i])) {
+            i++;
+            continue;
+        }
+        pool_.Release(unreleased_[i]);
+        unreleased_[i] = unreleased_.back();
+        unreleased_.pop_back();
+    }
+}
+
+/*
+ * Every subtree finished by the merge, at index in a level of level_size, goes through here.
+ * It is counted for the progress, checkpointed, then held by the out-of-core mode until its merge, unless hold is false.
+ * The root is never merged, so it is not held.
+ */
+void Chudnovsky::FinishPQT(RespPack& resp_pack, size_t level_size, bool hold) {
+    int n1, n2;
+    long order = SubtreeRange(level_size, resp_pack.GetID(), n1, n2);
+    if (progress_) progress_("tree", static_cast<double>(++finished_subtrees_) / total_subtrees_);
+    // after a cancellation, the subtrees are left empty
+    if (checkpoint_ && !cancelled_) checkpoint_->Save(level_size, resp_pack.GetID(), n1, n2, resp_pack.GetResult());
+    if (!spill_ || !hold || level_size <= 1) return;
+    spill_->Hold(resp_pack.GetResult(), order);
+}
+
+/*
+ * The last subtree of a level of odd size has no sibling: it is carried up unmerged, as the last subtree
+ * of the next level of level_size. So the merge tree is unbalanced when BATCH_NUM_ is not a power of 2.
+ */
+RespPack Chudnovsky::CarryPQT(RespPack& resp_pack, size_t level_size) {
+    AcquirePQT(resp_pack);
+    int worker = resp_pack.GetWorker();
+    RespPack carried(level_size - 1, resp_pack.GetN1(), resp_pack.GetN2(), resp_pack.TakeResult());
+    carried.SetWorker(worker);
+    resp_pack.Invalidate();
+    FinishPQT(carried, level_size);
+
+    return carried;
+}
+
+void Chudnovsky::AcquirePQT(RespPack& resp_pack) {
+    if (!spill_) return;
+    spill_->Acquire(resp_pack.GetResult());
+}
+
+/*
+ * In the truncated mode, an operand of a merge with more bits than pi needs loses its low limbs, in place,
+ * before its products are sent. It must not be under the checkpoint writer then.
+ */
+void Chudnovsky::TruncateOperand(PQT& pqt) {
+    if (!TRUNCATE_ || static_cast<long>(mpz_sizeinbase(pqt.Q->get_mpz_t(), 2)) <= TRUNCATE_BITS_) return;
+    if (checkpoint_) checkpoint_->WaitWritten(&pqt);
+    TruncatePQT(pqt, TRUNCATE_BITS_);
+    if (modcheck_) modcheck_->Of(pqt, pqt.mod);
+}
+
+/*
+ * MP multiplication, only huge products go to the multithreaded NTT since it is slower than GMP per core.
+ * These are the top levels of the merge, where most of the workers are idle.
+ */
+void Chudnovsky::Multiply(mpz_class& res, const mpz_class& a, const mpz_class& b) {
+    size_t a_size = mpz_size(a.get_mpz_t()), b_size = mpz_size(b.get_mpz_t());
+    if (NTT_THRESHOLD_ == 0 || NUM_OF_CORES_ <= 1 || std::min(a_size, b_size) < NTT_THRESHOLD_ || a_size + b_size > NTTMaxLimbs()) {
+        res = a * b;
+        return;
+    }
+
+    NTTMul(res, a, b, NUM_OF_CORES_);
+}
+
+/*
+ * Multiply() with the modular check: the product is multiplied again while its residues are not those of its operands.
+ * The residues of an operand which are not given are computed here, those of the product are given back in rout.
+ */
+void Chudnovsky::CheckedMultiply(mpz_class& res, const mpz_class& a, const mpz_class& b, const Residues* ra, const Residues* rb, Residues* rout) {
+    Residues expected = modcheck_->Mul(ra ? *ra : modcheck_->Of(a), rb ? *rb : modcheck_->Of(b));
+    for (int attempt = 1; ; attempt++) {
+        Multiply(res, a, b);
+        if (modcheck_->Check(expected, modcheck_->Of(res))) break;
+        std::cerr << " [X] Modular check of a product of " << mpz_size(a.get_mpz_t()) << " x " << mpz_size(b.get_mpz_t()) << " limbs failed";
+        if (attempt > MODCHECK_RETRIES) {
+            std::cerr << " " << attempt << " times, an operand may be corrupted" << std::endl;
+            break;
+        }
+        std::cerr << ", multiplying it again" << std::endl;
+    }
+    if (rout) *rout = expected;
+}
+
+/*
+ * Request of the product of component a of left by component b of right (P 0, Q 1, T 2) into out, a slot of the pool
+ * which is reserved for it here, with their residues and the slot of the residues of the product when the modular check is on.
+ */
+ReqPack Chudnovsky::ProductRequest(int id, const PQT& left, int a, const PQT& right, int b, mpz_class* out, Residues* out_mod) {
+    const mpz_class* x[3] = {left.P, left.Q, left.T};
+    const mpz_class* y[3] = {right.P, right.Q, right.T};
+    pool_.Reserve(out, *x[a], *y[b]);
+    if (!modcheck_) return ReqPack(id, x[a], y[b], out);
+
+    return ReqPack(id, x[a], y[b], out, &left.mod[a], &right.mod[b], out_mod);
+}
+
+/*
+ * T of a merge is T1 Q2 + P1 T2, whose second product is in the T2 slot of its node, and so are its residues.
+ */
+void Chudnovsky::AddT2(PQT& res) {
+    pool_.AddT2(&res);
+    if (modcheck_) res.mod[2] = modcheck_->Add(res.mod[2], *pool_.T2Mod(&res));
+}
+
 /*
  * Version 0:
  * Chudnovsky Algorithm in single thread mode
@@ -59,14 +459,17 @@ void Chudnovsky::Stop() {
 NativePQT Chudnovsky::ComputePQT(int n1, int n2) {
     int mid;
     NativePQT res;
+    // a cancelled run still answers every task, with empty results
+    if (cancelled_) return res;
+
+    if (sieve_) {
+        TermFactors terms(*sieve_, n2);
+        FacList fp, fq;
+        return ComputePQTFactored(n1, n2, terms, fp, fq);
+    }
 
-    if (n1 + 1 == n2) {
-        res.P = (2 * n2 - 1);
-        res.P *= (6 * n2 - 1);
-        res.P *= (6 * n2 - 5);
-        res.Q = C3_24_ * n2 * n2 * n2;
-        res.T = (A_ + B_ * n2) * res.P;
-        if ((n2 & 1) == 1) res.T = - res.T;
+    if (LeafPQTFits(n1, n2) || n1 + 1 == n2) {
+        res = ComputeLeafPQT(n1, n2);
     } else {
         mid = (n1 + n2) / 2;
         NativePQT res1 = ComputePQT(n1, mid);
@@ -79,6 +482,110 @@ NativePQT Chudnovsky::ComputePQT(int n1, int n2) {
     return res;
 }
 
+/*
+ * Bottom of the recursion: small ranges go to the leaf kernel, which does not create an mpz for every term,
+ * otherwise a single term.
+ */
+NativePQT Chudnovsky::ComputeLeafPQT(int n1, int n2) {
+    NativePQT res;
+
+    if (LeafPQTFits(n1, n2)) {
+        LeafPQT(n1, n2, res);
+        return res;
+    }
+
+    res.P = (2 * n2 - 1);
+    res.P *= (6 * n2 - 1);
+    res.P *= (6 * n2 - 5);
+    res.Q = C3_24_ * n2 * n2 * n2;
+    res.T = (A_ + B_ * n2) * res.P;
+    if ((n2 & 1) == 1) res.T = - res.T;
+
+    return res;
+}
+
+/*
+ * ComputePQT() with the common factor removal: fp and fq are the factors of the returned P and Q.
+ * Before the merge, the common factors of P of the left half and Q of the right half are divided out of both.
+ */
+NativePQT Chudnovsky::ComputePQTFactored(int n1, int n2, TermFactors& terms, FacList& fp, FacList& fq) {
+    NativePQT res;
+    if (cancelled_) {
+        fp.clear();
+        fq.clear();
+        return res;
+    }
+
+    if (LeafPQTFits(n1, n2) || n1 + 1 == n2) {
+        res = ComputeLeafPQT(n1, n2);
+        fp.clear();
+        fq.clear();
+        terms.Append(n1, n2, fp, fq);
+        for (const auto& f: C3_24_FAC_) {
+            fq.emplace_back(f.first, f.second * (n2 - n1));
+        }
+        SortFac(fp);
+        SortFac(fq);
+
+        return res;
+    }
+
+    int mid = (n1 + n2) / 2;
+    FacList fp1, fq1, fp2, fq2;
+    NativePQT res1 = ComputePQTFactored(n1, mid, terms, fp1, fq1);
+    NativePQT res2 = ComputePQTFactored(mid, n2, terms, fp2, fq2);
+    RemoveCommonFactors(res1.P, fp1, res2.Q, fq2);
+    res.P = res1.P * res2.P;
+    res.Q = res1.Q * res2.Q;
+    res.T = res1.T * res2.Q + res1.P * res2.T;
+    MergeFac(fp1, fp2, fp);
+    MergeFac(fq1, fq2, fq);
+
+    return res;
+}
+
+/*
+ * The primes of the sieve cover the square root of the largest factor of a term, 6N - 1, and C^3/24 is factored once.
+ * The terms themselves are sieved by every batch, so only the primes are built here.
+ */
+void Chudnovsky::PrepareFactorRemoval() {
+    if (!FACTOR_REMOVAL_) {
+        sieve_.reset();
+        return;
+    }
+    if (sieve_ && sieve_->Limit() >= 6U * N_) return;
+
+    auto start = std::chrono::steady_clock::now();
+    sieve_.reset(new FactorSieve(6U * N_));
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << " [*] Factor sieve: " << sieve_->Primes() << " primes, size(KB) = " << sieve_->Bytes() / 1024.0
+              << ", time(ms) = " << ms << std::endl;
+    C3_24_FAC_.clear();
+    FactorTrial(C3_24_.get_ui(), 1, C3_24_FAC_);
+}
+
+/*
+ * The root of a previous run to extend: its terms [0, FIRST_TERM_) are not computed again.
+ * A root of at least N_ terms gives pi to at least as many digits, so it is used as it is.
+ */
+void Chudnovsky::LoadBase() {
+    FIRST_TERM_ = 0;
+    base_ = nullptr;
+    if (EXTEND_ROOT_.empty()) return;
+
+    PQT* pqt = pool_.Node(pool_.Size() - 2);
+    int n;
+    if (!LoadRoot(EXTEND_ROOT_, n, *pqt)) {
+        std::cerr << " [X] Cannot load a root from " << EXTEND_ROOT_ << ", computing all the terms" << std::endl;
+        pool_.Release(pqt);
+        return;
+    }
+    if (modcheck_) modcheck_->Of(*pqt, pqt->mod);
+    base_ = pqt;
+    FIRST_TERM_ = n;
+    std::cerr << " [*] Extend the root of " << n << " terms from " << EXTEND_ROOT_ << " to " << N_ << " terms" << std::endl;
+}
+
 /*
  * Version 1:
  * Part 1. PQTMasterV1() distribute ReqPack into PQTWorkerV1().
@@ -87,36 +594,42 @@ NativePQT Chudnovsky::ComputePQT(int n1, int n2) {
  *         After combined the RespPack, return it back to ComputePQTMasterV1() for further distribution.
  * Part 3. It will have only 1 RespPack left in the end, and that is the result.
  */
-PQT Chudnovsky::PQTMasterV1() {
-    // pack the request
-    int begin = 0, end = BATCH_SIZE_;
-    for (int i = 0; i < BATCH_NUM_; i++) {
-        req_pack_q.push(ReqPack(i, begin, end));
-        begin = end;
-        end += BATCH_SIZE_;
-    }
+PQT* Chudnovsky::PQTMasterV1() {
+    size_t level_size = SendBatches();
 
-    return ComputePQTMasterV1();
+    return ComputePQTMasterV1(level_size);
 }
 
 /*
  */
-PQT Chudnovsky::ComputePQTMasterV1() {
+PQT* Chudnovsky::ComputePQTMasterV1(size_t level_size) {
     // prepare for response
     RespPack resp_pack;
-    std::vector<RespPack> resp_packs = std::vector<RespPack>(BATCH_NUM_);
+    std::vector<RespPack> resp_packs = std::vector<RespPack>(level_size);
     int sliding_window_begin = 0, sliding_window_end = 1;
     size_t resp_packs_size = resp_packs.size();
     while (!terminated) {
         // block at queue
         comp_resp_pack_q.pull(resp_pack);
-        resp_packs[resp_pack.GetID()] = resp_pack;
-
-        // check if we can do a CombinePQT()
-        while (sliding_window_end < resp_packs_size && resp_packs[sliding_window_begin].IsValid() && resp_packs[sliding_window_end].IsValid()) {
-            resp_packs[sliding_window_begin/2] = CombinePQTMasterV1(resp_packs[sliding_window_begin], resp_packs[sliding_window_end]);
+        FinishPQT(resp_pack, resp_packs_size);
+        resp_packs[resp_pack.GetID()] = std::move(resp_pack);
+
+        // check if we can do a CombinePQT(), or carry up the last subtree of an odd level
+        while (resp_packs_size > 1 && resp_packs[sliding_window_begin].IsValid()) {
+            size_t parent_size = (resp_packs_size + 1) >> 1;
+            if (sliding_window_end == resp_packs_size) {
+                resp_packs[sliding_window_begin/2] = CarryPQT(resp_packs[sliding_window_begin], parent_size);
+            } else if (resp_packs[sliding_window_end].IsValid()) {
+                // the last subtree of a level is on the right spine, whose P is never read unless the root is saved
+                bool need_p = NEED_ROOT_P_ || sliding_window_begin/2 + 1 < parent_size;
+                resp_packs[sliding_window_begin/2] = CombinePQTMasterV1(resp_packs[sliding_window_begin], resp_packs[sliding_window_end], need_p,
+                                                                        SubtreePQT(parent_size, sliding_window_begin/2));
+                FinishPQT(resp_packs[sliding_window_begin/2], parent_size);
+            } else {
+                break;
+            }
 
-            if (sliding_window_end != resp_packs_size-1) {
+            if (sliding_window_end + 1 < resp_packs_size) {
                 sliding_window_begin += 2;
                 sliding_window_end += 2;
                 continue;
@@ -124,7 +637,7 @@ PQT Chudnovsky::ComputePQTMasterV1() {
 
             sliding_window_begin = 0;
             sliding_window_end = 1;
-            resp_packs_size >>= 1;
+            resp_packs_size = parent_size;
             resp_packs.resize(resp_packs_size);
         }
         
@@ -132,91 +645,137 @@ PQT Chudnovsky::ComputePQTMasterV1() {
         if (resp_packs_size == 1) break;
     }
 
-    return *resp_packs[resp_packs_size-1].GetResult();
+    return resp_packs[resp_packs_size-1].GetResult();
 }
 
 /*
+ * The merge into res, P of the merge is only multiplied if need_p, otherwise it is left 0.
  */
-RespPack Chudnovsky::CombinePQTMasterV1(RespPack& resp_pack1, RespPack& resp_pack2) {
+RespPack Chudnovsky::CombinePQTMasterV1(RespPack& resp_pack1, RespPack& resp_pack2, bool need_p, PQT* res) {
     RespPack resp_pack;
-    PQT res;
-    std::shared_ptr<PQT> res1 = resp_pack1.GetResult();
-    std::shared_ptr<PQT> res2 = resp_pack2.GetResult();
-
-    req_pack_q.push(ReqPack(0, res1->P, res2->P));
-    req_pack_q.push(ReqPack(1, res1->Q, res2->Q));
-    req_pack_q.push(ReqPack(2, res1->T, res2->Q));
-    req_pack_q.push(ReqPack(3, res1->P, res2->T));
+    PQT& res1 = *resp_pack1.GetResult();
+    PQT& res2 = *resp_pack2.GetResult();
+    AcquirePQT(resp_pack1);
+    AcquirePQT(resp_pack2);
+    TruncateOperand(res1);
+    TruncateOperand(res2);
+
+    int worker = resp_pack1.GetWorker();
+
+    // the products are written in place into the node of the merge
+    Residues* mods = res->mod.data();
+    if (need_p) req_pack_q.push(ProductRequest(0, res1, 0, res2, 0, res->P, &mods[0]), worker);
+    req_pack_q.push(ProductRequest(1, res1, 1, res2, 1, res->Q, &mods[1]), worker);
+    req_pack_q.push(ProductRequest(2, res1, 2, res2, 1, res->T, &mods[2]), worker);
+    req_pack_q.push(ProductRequest(3, res1, 0, res2, 2, pool_.T2(res), pool_.T2Mod(res)), worker);
 
     // currently do the combining sequentially, and do it one by one
-    std::vector<RespPack> resp_packs = std::vector<RespPack>(4);
-    for (int i = 0; i < 4; i++) {
+    for (int i = need_p ? 0 : 1; i < 4; i++) {
         comb_resp_pack_q.pull(resp_pack);
-        resp_packs[resp_pack.GetID()] = resp_pack;
     }
 
-    res.P = resp_packs[0].Geta();
-    res.Q = resp_packs[1].Geta();
-    res.T = resp_packs[2].Geta();
-    *res.T += *resp_packs[3].Geta();
+    AddT2(*res);
+    if (TRUNCATE_) res->err = MergeError(res1, res2);
+    ReleasePQT(&res1);
+    ReleasePQT(&res2);
 
-    return RespPack(resp_pack1.GetID()/2, resp_pack1.GetN1(), resp_pack2.GetN2(), std::make_shared<PQT>(res));
+    return RespPack(resp_pack1.GetID()/2, resp_pack1.GetN1(), resp_pack2.GetN2(), res);
 }
 
-void Chudnovsky::PQTWorkerV1() {
+void Chudnovsky::PQTWorkerV1(int worker_no) {
     ReqPack req_pack;
+    req_pack_q.Register(worker_no);
+    TraceThread("worker " + std::to_string(worker_no));
     while (!terminated) {
         // block at queue
+        int64_t idle = TraceEnabled() ? TraceNow() : -1;
         req_pack_q.pull(req_pack);
 
         // check if terminiated
         if (!req_pack.IsValid()) break;
+        TraceEvent event = {};
+        if (idle >= 0) {
+            event = TaskEvent(req_pack, TraceNow());
+            TraceRecord({"idle", "idle", idle, event.begin, -1, -1, 0, 0, 0, 0});
+        }
 
         if (req_pack.GetType() == TYPE_COMPUTE) {
-            // do ComputePQT()
-            NativePQT native_res = ComputePQT(req_pack.GetN1(), req_pack.GetN2());
-            PQT res = {
-                .P = std::make_shared<mpz_class>(native_res.P),
-                .Q = std::make_shared<mpz_class>(native_res.Q),
-                .T = std::make_shared<mpz_class>(native_res.T)
-            };
+            // do ComputePQT(), unless an earlier run left the batch in the cache
+            NativePQT native_res;
+            if (!cache_ || !cache_->Lookup(req_pack.GetN1(), req_pack.GetN2(), native_res)) {
+                native_res = ComputePQT(req_pack.GetN1(), req_pack.GetN2());
+                if (cache_ && !cancelled_) cache_->Store(req_pack.GetN1(), req_pack.GetN2(), native_res);
+            }
+            // into the node of the batch, without copying the limbs
+            PQT* res = req_pack.GetPQT();
+            res->P->swap(native_res.P);
+            res->Q->swap(native_res.Q);
+            res->T->swap(native_res.T);
+            if (modcheck_) modcheck_->Of(*res, res->mod);
 
             // generate a RespPack
-            RespPack resp_pack(req_pack, std::make_shared<PQT>(res));
+            RespPack resp_pack(req_pack, res);
+            resp_pack.SetWorker(worker_no);
 
-            // push a RespPack
-            comp_resp_pack_q.push(resp_pack);
+            // push a RespPack, version 4 waits for all of its tasks on one queue
+            if (VERSION_ == 4) comb_resp_pack_q.push(std::move(resp_pack));
+            else comp_resp_pack_q.push(std::move(resp_pack));
         } else if (req_pack.GetType() == TYPE_COMBINE) {
-            // TODO: we should define a new mpz_class here
-            // because the source data is currently shared between multiple thread, can't modify them
-            // or it will cause data error
-
-            // do mpz multiplicate
-            mpz_class res = *req_pack.Geta() * *req_pack.Getb();
+            // do mpz multiplicate, straight into the slot of the product
+            // the operands are shared between multiple thread, so they are only read
+            if (!cancelled_ && modcheck_) CheckedMultiply(*req_pack.Getout(), *req_pack.Getpa(), *req_pack.Getpb(), req_pack.GetRa(), req_pack.GetRb(), req_pack.GetRout());
+            else if (!cancelled_) Multiply(*req_pack.Getout(), *req_pack.Getpa(), *req_pack.Getpb());
 
             // generate a RespPack
-            RespPack resp_pack(req_pack, std::make_shared<mpz_class>(res));
+            RespPack resp_pack(req_pack);
+            resp_pack.SetWorker(worker_no);
 
             // push a RespPack
-            comb_resp_pack_q.push(resp_pack);
+            comb_resp_pack_q.push(std::move(resp_pack));
         } else if (req_pack.GetType() == TYPE_COMBINE2) {
-            PQT res;
-
-            // do combination
-            res.P = req_pack.Geta();
-            res.Q = req_pack.Getb();
-            res.T = req_pack.Getc();
-            *res.T += *req_pack.Getd();
+            // do combination, T += T2 in the node of the merge
+            pool_.AddT2(req_pack.GetPQT());
 
             // generate a RespPack
-            RespPack resp_pack(req_pack, std::make_shared<PQT>(res));
+            RespPack resp_pack(req_pack, req_pack.GetPQT());
+            resp_pack.SetWorker(worker_no);
 
             // push a RespPack
-            comp_resp_pack_q.push(resp_pack);
+            comp_resp_pack_q.push(std::move(resp_pack));
+        } else if (req_pack.GetType() == TYPE_CONVERT) {
+            ConvertWorker(req_pack);
+        }
+        if (idle >= 0) {
+            event.end = TraceNow();
+            TraceRecord(event);
         }
     }
 }
 
+/*
+ * One subtree of the binary to decimal conversion, [n1, n1+n2) are the digits it owns.
+ * A big subtree is split in 2 tasks pushed to the own deque, so that idle workers steal them,
+ * and a small one is converted right here into its slice of the output buffer.
+ */
+void Chudnovsky::ConvertWorker(ReqPack& req_pack) {
+    long offset = req_pack.GetN1(), digits = req_pack.GetN2();
+    int k;
+    long lo_digits = SplitDigits(digits, pow10_, k);
+
+    if (digits <= CONVERT_TASK_DIGITS_ || lo_digits == 0) {
+        PutDigits(out_buf_, out_int_len_, offset, digits, *req_pack.Geta());
+        out_resp_pack_q.push(RespPack(req_pack.GetID(), offset, digits, nullptr));
+        return;
+    }
+
+    std::shared_ptr<mpz_class> hi = std::make_shared<mpz_class>(), lo = std::make_shared<mpz_class>();
+    mpz_tdiv_qr(hi->get_mpz_t(), lo->get_mpz_t(), req_pack.Geta()->get_mpz_t(), pow10_[k].get_mpz_t());
+    req_pack.Invalidate();
+
+    req_pack_q.push(ReqPack(0, offset + digits - lo_digits, lo_digits, lo));
+    req_pack_q.push(ReqPack(0, offset, digits - lo_digits, hi));
+}
+
 /* 
  * Version 2:
  * Part 1. PQTMasterV2() distribute ReqPack into PQTWorkerV1().
@@ -224,47 +783,51 @@ void Chudnovsky::PQTWorkerV1() {
  * Part 2. Then, CombinePQTMasterV2() and CombinePQTMergerV2() will only do the MP addition based on worker result, and store the result back to ComputePQTMasterV2().
  * Part 3. It will have only 1 RespPack left in the end, and that is the result.
  */
-PQT Chudnovsky::PQTMasterV2() {
-    // pack the request
-    int begin = 0, end = BATCH_SIZE_;
-    for (int i = 0; i < BATCH_NUM_; i++) {
-        req_pack_q.push(ReqPack(i, begin, end));
-        begin = end;
-        end += BATCH_SIZE_;
-    }
+PQT* Chudnovsky::PQTMasterV2() {
+    size_t level_size = SendBatches();
 
-    return ComputePQTMasterV2();
+    return ComputePQTMasterV2(level_size);
 }
 
 /*
  */
-PQT Chudnovsky::ComputePQTMasterV2() {
+PQT* Chudnovsky::ComputePQTMasterV2(size_t level_size) {
     // prepare for response
     RespPack resp_pack;
-    std::vector<RespPack> resp_packs = std::vector<RespPack>(BATCH_NUM_);
+    std::vector<RespPack> resp_packs = std::vector<RespPack>(level_size);
+    operands_.assign(level_size, nullptr);
     int sliding_window_begin = 0, sliding_window_end = 1;
     size_t resp_packs_size = resp_packs.size();
     while (!terminated) {
         // block at queue
         comp_resp_pack_q.pull(resp_pack);
-        resp_packs[resp_pack.GetID()] = resp_pack;
+        FinishPQT(resp_pack, resp_packs_size);
+        resp_packs[resp_pack.GetID()] = std::move(resp_pack);
 
         // check if we can prepare to combine the result
-        while (sliding_window_end < resp_packs_size && resp_packs[sliding_window_begin].IsValid() && resp_packs[sliding_window_end].IsValid()) {
-            // the function to send ReqPack
-            CombinePQTSenderV2(resp_packs[sliding_window_begin], resp_packs[sliding_window_end]);
+        while (resp_packs_size > 1 && resp_packs[sliding_window_begin].IsValid()) {
+            // the last subtree of an odd level waits at the end of the level, to be carried up
+            if (sliding_window_end < resp_packs_size) {
+                if (!resp_packs[sliding_window_end].IsValid()) break;
+                // the function to send ReqPack, the last subtree of a level is on the right spine, whose P is never read unless the root is saved
+                bool need_p = NEED_ROOT_P_ || sliding_window_begin/2 + 1 < ((resp_packs_size + 1) >> 1);
+                CombinePQTSenderV2(resp_packs[sliding_window_begin], resp_packs[sliding_window_end], need_p,
+                                   SubtreePQT((resp_packs_size + 1) >> 1, sliding_window_begin/2));
+            }
 
             // if we finished the first compute part, start the second - combine part
-            if (sliding_window_end != resp_packs_size-1) {
+            if (sliding_window_end + 1 < resp_packs_size) {
                 // slide the window, which contains the current focused RespPack that is going to combined
                 sliding_window_begin += 2;
                 sliding_window_end += 2;
                 continue;
             }
 
-            resp_packs_size >>= 1;
+            size_t pairs = resp_packs_size >> 1;
+            if (resp_packs_size & 1) resp_packs[pairs] = CarryPQT(resp_packs[resp_packs_size-1], pairs + 1);
+            resp_packs_size = (resp_packs_size + 1) >> 1;
             resp_packs.resize(resp_packs_size);
-            CombinePQTMasterV2(resp_packs, resp_packs_size);
+            CombinePQTMasterV2(resp_packs, pairs);
 
             sliding_window_begin = 0;
             sliding_window_end = 1;
@@ -274,25 +837,35 @@ PQT Chudnovsky::ComputePQTMasterV2() {
         if (resp_packs_size == 1) break;
     }
 
-    return *resp_packs[resp_packs_size-1].GetResult();
+    return resp_packs[resp_packs_size-1].GetResult();
 }
 
 /*
  */
-void Chudnovsky::CombinePQTMasterV2(std::vector<RespPack>& parent_resp_packs, size_t resp_packs_size) {
+void Chudnovsky::CombinePQTMasterV2(std::vector<RespPack>& parent_resp_packs, size_t pairs) {
     RespPack resp_pack;
-    std::vector<RespPack> resp_packs = std::vector<RespPack>(4*resp_packs_size);
+    size_t parent_size = parent_resp_packs.size();
+    std::vector<RespPack> resp_packs = std::vector<RespPack>(4*pairs);
     int sliding_window_begin = 0, sliding_window_end = 3;
-    resp_packs_size = resp_packs.size();
+    size_t resp_packs_size = resp_packs.size();
+    // without a carried subtree, the last parent is on the right spine, and its P was not sent unless the root is saved
+    if (pairs == parent_resp_packs.size() && !NEED_ROOT_P_) resp_packs[4*pairs-4] = RespPack(4*pairs-4, nullptr);
     while (!terminated) {
         comb_resp_pack_q.pull(resp_pack);
-        resp_packs[resp_pack.GetID()] = resp_pack;
+        resp_packs[resp_pack.GetID()] = std::move(resp_pack);
 
         while (sliding_window_end < resp_packs_size && CombinePQTCheckResultV2(resp_packs, sliding_window_begin, sliding_window_end)) {
             int id = sliding_window_begin >> 2;
-            parent_resp_packs[id<<1].Invalidate();
-            parent_resp_packs[(id<<1)+1].Invalidate();
-            parent_resp_packs[id] = RespPack(id, std::make_shared<PQT>(CombinePQTMergerV2(resp_packs, sliding_window_begin)));
+            PQT* res = SubtreePQT(parent_size, id);
+            AddT2(*res);
+            parent_resp_packs[id] = RespPack(id, res);
+            if (TRUNCATE_) res->err = MergeError(*operands_[id<<1], *operands_[(id<<1)+1]);
+            // the children were invalidated when sent, and their slots may already hold the carried subtree
+            ReleasePQT(operands_[id<<1]);
+            ReleasePQT(operands_[(id<<1)+1]);
+            operands_[id<<1] = nullptr;
+            operands_[(id<<1)+1] = nullptr;
+            FinishPQT(parent_resp_packs[id], parent_size);
 
             if (sliding_window_end != resp_packs_size-1) {
                 sliding_window_begin += 4;
@@ -305,19 +878,6 @@ void Chudnovsky::CombinePQTMasterV2(std::vector<RespPack>& parent_resp_packs, si
     }
 }
 
-/* 
- */
-PQT Chudnovsky::CombinePQTMergerV2(std::vector<RespPack>& resp_packs, int sliding_window_begin) {
-    PQT res;
-
-    res.P = resp_packs[sliding_window_begin].Geta();
-    res.Q = resp_packs[sliding_window_begin+1].Geta();
-    res.T = resp_packs[sliding_window_begin+2].Geta();
-    *res.T += *resp_packs[sliding_window_begin+3].Geta();
-
-    return res;
-}
-
 /*
  */
 bool Chudnovsky::CombinePQTCheckResultV2(std::vector<RespPack>& resp_packs, int begin, int end) {
@@ -329,16 +889,29 @@ bool Chudnovsky::CombinePQTCheckResultV2(std::vector<RespPack>& resp_packs, int
 }
 
 /* 
+ * The products of the merge into res, P of the merge is only multiplied if need_p, otherwise its slot is left 0.
  */
-void Chudnovsky::CombinePQTSenderV2(RespPack& resp_pack1, RespPack& resp_pack2) {
-    std::shared_ptr<PQT> res1 = resp_pack1.GetResult();
-    std::shared_ptr<PQT> res2 = resp_pack2.GetResult();
-    int res_id_base = resp_pack1.GetID()*2;
-
-    req_pack_q.push(ReqPack(res_id_base+0, res1->P, res2->P));
-    req_pack_q.push(ReqPack(res_id_base+1, res1->Q, res2->Q));
-    req_pack_q.push(ReqPack(res_id_base+2, res1->T, res2->Q));
-    req_pack_q.push(ReqPack(res_id_base+3, res1->P, res2->T));
+void Chudnovsky::CombinePQTSenderV2(RespPack& resp_pack1, RespPack& resp_pack2, bool need_p, PQT* res) {
+    AcquirePQT(resp_pack1);
+    AcquirePQT(resp_pack2);
+    int id1 = resp_pack1.GetID(), id2 = resp_pack2.GetID();
+    int res_id_base = id1*2;
+    // the worker which produced the left operands still has them in cache
+    int worker = resp_pack1.GetWorker();
+
+    // master keeps the operands until the products of their parent are done
+    operands_[id1] = resp_pack1.TakeResult();
+    operands_[id2] = resp_pack2.TakeResult();
+    TruncateOperand(*operands_[id1]);
+    TruncateOperand(*operands_[id2]);
+    const PQT& res1 = *operands_[id1];
+    const PQT& res2 = *operands_[id2];
+
+    Residues* mods = res->mod.data();
+    if (need_p) req_pack_q.push(ProductRequest(res_id_base+0, res1, 0, res2, 0, res->P, &mods[0]), worker);
+    req_pack_q.push(ProductRequest(res_id_base+1, res1, 1, res2, 1, res->Q, &mods[1]), worker);
+    req_pack_q.push(ProductRequest(res_id_base+2, res1, 2, res2, 1, res->T, &mods[2]), worker);
+    req_pack_q.push(ProductRequest(res_id_base+3, res1, 0, res2, 2, pool_.T2(res), pool_.T2Mod(res)), worker);
 
     resp_pack1.Invalidate();
     resp_pack2.Invalidate();
@@ -350,47 +923,51 @@ void Chudnovsky::CombinePQTSenderV2(RespPack& resp_pack1, RespPack& resp_pack2)
  * But this performs a little bit worse, because of the overhead on ReqPack & RespPack is more than perform addition.
  * So, currently use PQTMasterV2() as our default implementation.
  */
-PQT Chudnovsky::PQTMasterV3() {
-    // pack the request
-    int begin = 0, end = BATCH_SIZE_;
-    for (int i = 0; i < BATCH_NUM_; i++) {
-        req_pack_q.push(ReqPack(i, begin, end));
-        begin = end;
-        end += BATCH_SIZE_;
-    }
+PQT* Chudnovsky::PQTMasterV3() {
+    size_t level_size = SendBatches();
 
-    return ComputePQTMasterV3();
+    return ComputePQTMasterV3(level_size);
 }
 
 /*
  */
-PQT Chudnovsky::ComputePQTMasterV3() {
+PQT* Chudnovsky::ComputePQTMasterV3(size_t level_size) {
     // prepare for response
     RespPack resp_pack;
-    std::vector<RespPack> resp_packs = std::vector<RespPack>(BATCH_NUM_);
+    std::vector<RespPack> resp_packs = std::vector<RespPack>(level_size);
+    operands_.assign(level_size, nullptr);
     int sliding_window_begin = 0, sliding_window_end = 1;
     size_t resp_packs_size = resp_packs.size();
     while (!terminated) {
         // block at queue
         comp_resp_pack_q.pull(resp_pack);
-        resp_packs[resp_pack.GetID()] = resp_pack;
+        FinishPQT(resp_pack, resp_packs_size);
+        resp_packs[resp_pack.GetID()] = std::move(resp_pack);
 
         // check if we can prepare to combine the result
-        while (sliding_window_end < resp_packs_size && resp_packs[sliding_window_begin].IsValid() && resp_packs[sliding_window_end].IsValid()) {
-            // the function to send ReqPack
-            CombinePQTSenderV2(resp_packs[sliding_window_begin], resp_packs[sliding_window_end]);
+        while (resp_packs_size > 1 && resp_packs[sliding_window_begin].IsValid()) {
+            // the last subtree of an odd level waits at the end of the level, to be carried up
+            if (sliding_window_end < resp_packs_size) {
+                if (!resp_packs[sliding_window_end].IsValid()) break;
+                // the function to send ReqPack, the last subtree of a level is on the right spine, whose P is never read unless the root is saved
+                bool need_p = NEED_ROOT_P_ || sliding_window_begin/2 + 1 < ((resp_packs_size + 1) >> 1);
+                CombinePQTSenderV2(resp_packs[sliding_window_begin], resp_packs[sliding_window_end], need_p,
+                                   SubtreePQT((resp_packs_size + 1) >> 1, sliding_window_begin/2));
+            }
 
             // if we finished the first compute part, start the second - combine part
-            if (sliding_window_end != resp_packs_size-1) {
+            if (sliding_window_end + 1 < resp_packs_size) {
                 // slide the window, which contains the current focused RespPack that is going to combined
                 sliding_window_begin += 2;
                 sliding_window_end += 2;
                 continue;
             }
 
-            resp_packs_size >>= 1;
+            size_t pairs = resp_packs_size >> 1;
+            if (resp_packs_size & 1) resp_packs[pairs] = CarryPQT(resp_packs[resp_packs_size-1], pairs + 1);
+            resp_packs_size = (resp_packs_size + 1) >> 1;
             resp_packs.resize(resp_packs_size);
-            CombinePQTMasterV3(resp_packs, resp_packs_size);
+            CombinePQTMasterV3(resp_packs, pairs);
 
             sliding_window_begin = 0;
             sliding_window_end = 1;
@@ -402,25 +979,33 @@ PQT Chudnovsky::ComputePQTMasterV3() {
         if (resp_packs_size == 1 && resp_packs[0].IsValid()) break;
     }
 
-    return *resp_packs[resp_packs_size-1].GetResult();
+    return resp_packs[resp_packs_size-1].GetResult();
 }
 
 /*
  */
-void Chudnovsky::CombinePQTMasterV3(std::vector<RespPack>& parent_resp_packs, size_t resp_packs_size) {
+void Chudnovsky::CombinePQTMasterV3(std::vector<RespPack>& parent_resp_packs, size_t pairs) {
     RespPack resp_pack;
-    std::vector<RespPack> resp_packs = std::vector<RespPack>(4*resp_packs_size);
+    std::vector<RespPack> resp_packs = std::vector<RespPack>(4*pairs);
     int sliding_window_begin = 0, sliding_window_end = 3;
-    resp_packs_size = resp_packs.size();
+    size_t resp_packs_size = resp_packs.size();
+    // without a carried subtree, the last parent is on the right spine, and its P was not sent unless the root is saved
+    if (pairs == parent_resp_packs.size() && !NEED_ROOT_P_) resp_packs[4*pairs-4] = RespPack(4*pairs-4, nullptr);
     while (!terminated) {
         comb_resp_pack_q.pull(resp_pack);
-        resp_packs[resp_pack.GetID()] = resp_pack;
+        resp_packs[resp_pack.GetID()] = std::move(resp_pack);
 
         while (sliding_window_end < resp_packs_size && CombinePQTCheckResultV2(resp_packs, sliding_window_begin, sliding_window_end)) {
             int id = sliding_window_begin >> 2;
-            parent_resp_packs[id<<1].Invalidate();
-            parent_resp_packs[(id<<1)+1].Invalidate();
-            Combine2PQTSenderV3(id, resp_packs, sliding_window_begin);
+            // the parent is finished by a worker, which only adds the products of its T
+            PQT* res = SubtreePQT(parent_resp_packs.size(), id);
+            if (TRUNCATE_) res->err = MergeError(*operands_[id<<1], *operands_[(id<<1)+1]);
+            // the children were invalidated when sent, and their slots may already hold the carried subtree
+            ReleasePQT(operands_[id<<1]);
+            ReleasePQT(operands_[(id<<1)+1]);
+            operands_[id<<1] = nullptr;
+            operands_[(id<<1)+1] = nullptr;
+            Combine2PQTSenderV3(id, res, resp_packs, sliding_window_begin);
 
             if (sliding_window_end != resp_packs_size-1) {
                 sliding_window_begin += 4;
@@ -435,8 +1020,10 @@ void Chudnovsky::CombinePQTMasterV3(std::vector<RespPack>& parent_resp_packs, si
 
 /* 
  */
-void Chudnovsky::Combine2PQTSenderV3(int id, std::vector<RespPack>& resp_packs, int index) {
-    req_pack_q.push(ReqPack(id, resp_packs[index].Geta(), resp_packs[index+1].Geta(), resp_packs[index+2].Geta(), resp_packs[index+3].Geta()));
+void Chudnovsky::Combine2PQTSenderV3(int id, PQT* res, std::vector<RespPack>& resp_packs, int index) {
+    if (modcheck_) res->mod[2] = modcheck_->Add(res->mod[2], *pool_.T2Mod(res));
+    // the addition is done on T, so send it to the worker which produced it
+    req_pack_q.push(ReqPack(id, res, pool_.T2(res)), resp_packs[index+2].GetWorker());
 
     resp_packs[index].Invalidate();
     resp_packs[index+1].Invalidate();
@@ -444,49 +1031,476 @@ void Chudnovsky::Combine2PQTSenderV3(int id, std::vector<RespPack>& resp_packs,
     resp_packs[index+3].Invalidate();
 }
 
+/*
+ * Version 4:
+ * Part 1. The merge tree of V2 is an explicit task DAG: every leaf batch, every product (P, Q, T1, T2) of a merge,
+ *         and the addition T = T1 + T2 are nodes, and a product depends only on the components it reads,
+ *         e.g. P of a parent is multiplied as soon as P of both children exist, while their T are still computed.
+ * Part 2. Ready tasks wait in a priority queue on master, ordered by their critical path: their own estimated cost
+ *         plus the cost of the longest chain of products from them to the root. Master only keeps one task per worker
+ *         in flight, so that the next task is chosen when a worker is free, and a long leaf does not queue in front of
+ *         a product which holds back the root. The additions are done by master as soon as both products are back.
+ * Part 3. The root is the result.
+ */
+PQT* Chudnovsky::PQTMasterV4() {
+    std::vector<RespPack> finished;
+    size_t level_size = LoadCheckpoint(finished);
+    int root = BuildDagV4(level_size);
+
+    for (auto& resp_pack: finished) {
+        dag_[resp_pack.GetID()].pqt = resp_pack.TakeResult();
+        FinishDagV4(resp_pack.GetID());
+    }
+    for (size_t i = 0; i < level_size; i++) {
+        if (level_size == BATCH_NUM_ && !dag_[i].pqt) dag_ready_.push({BatchCost(dag_[i].n1, dag_[i].n2) + dag_[i].tail, static_cast<int>(i), -1});
+    }
+    DispatchDagV4();
+
+    RespPack resp_pack;
+    while (!terminated && !(dag_[root].ready[0] && dag_[root].ready[1] && dag_[root].ready[2])) {
+        comb_resp_pack_q.pull(resp_pack);
+        dag_in_flight_--;
+
+        if (resp_pack.GetType() == TYPE_COMPUTE) {
+            DagNode& leaf = dag_[resp_pack.GetID()];
+            leaf.worker = resp_pack.GetWorker();
+            leaf.pqt = resp_pack.TakeResult();
+            FinishDagV4(resp_pack.GetID());
+        } else {
+            int id = resp_pack.GetID() >> 2, k = resp_pack.GetID() & 3;
+            DagNode& node = dag_[id];
+            node.done[k] = true;
+            // in the truncated mode, a node is only read once it is complete, since it is truncated as a whole
+            if (k == 0 && !TRUNCATE_) ReadyDagV4(id, 0);
+            if (k == 1 && !TRUNCATE_) ReadyDagV4(id, 1);
+            if ((k == 2 || k == 3) && node.done[2] && node.done[3]) {
+                AddT2(*node.pqt);
+                node.worker = resp_pack.GetWorker();
+                if (!TRUNCATE_) ReadyDagV4(id, 2);
+            }
+            // all products are done, the children are not needed anymore
+            if (node.done[0] && node.done[1] && node.done[2] && node.done[3]) {
+                if (TRUNCATE_) node.pqt->err = MergeError(*dag_[node.left].pqt, *dag_[node.right].pqt);
+                ReleasePQT(dag_[node.left].pqt);
+                ReleasePQT(dag_[node.right].pqt);
+                dag_[node.left].pqt = nullptr;
+                dag_[node.right].pqt = nullptr;
+                FinishDagV4(id);
+            }
+        }
+        DispatchDagV4();
+    }
+
+    PQT* res = dag_[root].pqt;
+    dag_.clear();
+
+    return res;
+}
+
+/*
+ * The nodes of the same merge tree as V2, starting from a level of level_size whose subtrees are the leaves of the DAG,
+ * which are the first nodes. Returns the root.
+ */
+int Chudnovsky::BuildDagV4(size_t level_size) {
+    dag_.clear();
+    dag_ready_ = std::priority_queue<DagTask>();
+    dag_in_flight_ = 0;
+
+    auto add_node = [this](int left, int right, int n1, int n2, size_t level_size, int id) {
+        DagNode node = {};
+        node.left = left;
+        node.right = right;
+        node.parent = -1;
+        node.worker = -1;
+        node.n1 = n1;
+        node.n2 = n2;
+        node.levels.emplace_back(level_size, id);
+        dag_.push_back(std::move(node));
+
+        return static_cast<int>(dag_.size()) - 1;
+    };
+
+    std::vector<int> level(level_size);
+    for (size_t i = 0; i < level_size; i++) {
+        int n1, n2;
+        SubtreeRange(level_size, i, n1, n2);
+        level[i] = add_node(-1, -1, n1, n2, level_size, i);
+    }
+    for (size_t size = level_size; size > 1; size = (size + 1) >> 1) {
+        size_t parent_size = (size + 1) >> 1;
+        std::vector<int> parents(parent_size);
+        for (size_t i = 0; i + 1 < size; i += 2) {
+            parents[i/2] = add_node(level[i], level[i+1], dag_[level[i]].n1, dag_[level[i+1]].n2, parent_size, i/2);
+            dag_[level[i]].parent = dag_[level[i+1]].parent = parents[i/2];
+        }
+        // the last subtree of an odd level is carried up, as in V2
+        if (size & 1) {
+            parents[parent_size-1] = level[size-1];
+            dag_[level[size-1]].levels.emplace_back(parent_size, parent_size - 1);
+        }
+        level = std::move(parents);
+    }
+
+    // the critical path of a child goes through the longest product of its parent, parents are after their children
+    for (int i = static_cast<int>(dag_.size()) - 1; i >= 0; i--) {
+        DagNode& node = dag_[i];
+        if (node.left < 0) continue;
+        double cost = 0;
+        for (int k = 0; k < 4; k++) {
+            static const int a[4] = {0, 1, 2, 0}, b[4] = {0, 1, 1, 2};
+            double bits = ComponentBitsV4(node.left, a[k]) + ComponentBitsV4(node.right, b[k]);
+            cost = std::max(cost, bits * log2(bits + 2));
+        }
+        dag_[node.left].tail = dag_[node.right].tail = node.tail + cost;
+    }
+
+    // P of the right spine is never read, unless the root is saved, so its products are not sent
+    for (int i = level[0]; !NEED_ROOT_P_ && dag_[i].left >= 0; i = dag_[i].right) {
+        dag_[i].sent[0] = dag_[i].done[0] = dag_[i].ready[0] = true;
+    }
+
+    return level[0];
+}
+
+/*
+ * Estimated size of P (0), Q (1) or T (2) of a node, whose terms grow like 72 k^3 and C^3/24 k^3, T is about as large as Q.
+ */
+double Chudnovsky::ComponentBitsV4(int node, int component) {
+    int n1 = dag_[node].n1, n2 = dag_[node].n2;
+    double log2_k = (std::lgamma(n2 + 1.0) - std::lgamma(n1 + 1.0)) / M_LN2;
+
+    return (n2 - n1) * (component == 0 ? log2(72.0) : log2(C3_24_.get_d())) + 3 * log2_k;
+}
+
+/*
+ * A component of node exists: send the products of the parent which read only components which exist.
+ */
+void Chudnovsky::ReadyDagV4(int node, int component) {
+    dag_[node].ready[component] = true;
+    int parent = dag_[node].parent;
+    if (parent < 0) return;
+
+    DagNode& p = dag_[parent];
+    // product k multiplies component a[k] of the left child by component b[k] of the right child
+    static const int a[4] = {0, 1, 2, 0}, b[4] = {0, 1, 1, 2};
+    for (int k = 0; k < 4; k++) {
+        if (p.sent[k] || !dag_[p.left].ready[a[k]] || !dag_[p.right].ready[b[k]]) continue;
+        p.sent[k] = true;
+        double bits = ComponentBitsV4(p.left, a[k]) + ComponentBitsV4(p.right, b[k]);
+        dag_ready_.push({bits * log2(bits + 2) + p.tail, parent, k});
+    }
+}
+
+/*
+ * All components of node exist: it is checkpointed on every level it belongs to, and held by the out-of-core mode
+ * on the last one, unless a product of its parent already reads it.
+ */
+void Chudnovsky::FinishDagV4(int node) {
+    DagNode& n = dag_[node];
+    for (size_t i = 0; i < n.levels.size(); i++) {
+        RespPack resp_pack(n.levels[i].second, n.n1, n.n2, n.pqt);
+        FinishPQT(resp_pack, n.levels[i].first, i + 1 == n.levels.size() && !n.read);
+    }
+    ReadyDagV4(node, 0);
+    ReadyDagV4(node, 1);
+    ReadyDagV4(node, 2);
+}
+
+/*
+ * Send the ready tasks with the longest critical path, one per free worker.
+ */
+void Chudnovsky::DispatchDagV4() {
+    while (dag_in_flight_ < NUM_OF_CORES_ && !dag_ready_.empty()) {
+        DagTask task = dag_ready_.top();
+        dag_ready_.pop();
+        dag_in_flight_++;
+
+        DagNode& node = dag_[task.node];
+        if (task.k < 0) {
+            req_pack_q.push(ReqPack(task.node, node.n1, node.n2, SubtreePQT(node.levels[0].first, node.levels[0].second)));
+            continue;
+        }
+
+        DagNode& left = dag_[node.left];
+        DagNode& right = dag_[node.right];
+        // the children must be in memory from their first read on
+        for (DagNode* child: {&left, &right}) {
+            if (child->read) continue;
+            child->read = true;
+            if (spill_) spill_->Acquire(child->pqt);
+            TruncateOperand(*child->pqt);
+        }
+        if (!node.pqt) node.pqt = SubtreePQT(node.levels[0].first, node.levels[0].second);
+
+        const PQT& l = *left.pqt;
+        const PQT& r = *right.pqt;
+        int id = (task.node << 2) + task.k;
+        Residues* mods = node.pqt->mod.data();
+        if (task.k == 0) req_pack_q.push(ProductRequest(id, l, 0, r, 0, node.pqt->P, &mods[0]), left.worker);
+        else if (task.k == 1) req_pack_q.push(ProductRequest(id, l, 1, r, 1, node.pqt->Q, &mods[1]), left.worker);
+        else if (task.k == 2) req_pack_q.push(ProductRequest(id, l, 2, r, 1, node.pqt->T, &mods[2]), left.worker);
+        else req_pack_q.push(ProductRequest(id, l, 0, r, 2, pool_.T2(node.pqt), pool_.T2Mod(node.pqt)), right.worker);
+    }
+}
+
 /*
  */
 void Chudnovsky::PIWorker() {
     ReqPack req_pack;
+    TraceThread("pi worker");
 
     while (!terminated) {
         // wait for signal
         final_req_pack_q.pull(req_pack);
         if (!req_pack.IsValid()) break;
+        TraceSpan span("sqrt", "task");
         mpf_class res(sqrt((mpf_class)E_), PREC_);
         final_resp_pack_q.push(RespPack(req_pack, std::make_shared<mpf_class>(res)));
     }
 }
 
+/*
+ * Huge product of the final stage, which runs on master while the workers are idle.
+ * It is split by Karatsuba into 3^level independent products (at least one per worker), which are sent to the workers.
+ * This must only be called by master, since it takes over comb_resp_pack_q.
+ */
+void Chudnovsky::ParallelMultiply(mpz_class& res, const mpz_class& a, const mpz_class& b) {
+    int level = 0;
+    for (int tasks = 1; tasks < NUM_OF_CORES_ && level < 3; tasks *= 3) level++;
+
+    std::vector<std::pair<mpz_class, mpz_class>> leaves;
+    std::vector<mp_bitcnt_t> splits;
+    KaratsubaSplit(a, b, level, 1 << 12, leaves, splits);
+    if (leaves.size() == 1) {
+        Multiply(res, a, b);
+        return;
+    }
+
+    std::vector<mpz_class> products(leaves.size());
+    for (size_t i = 0; i < leaves.size(); i++) {
+        req_pack_q.push(ReqPack(i, &leaves[i].first, &leaves[i].second, &products[i]));
+    }
+
+    RespPack resp_pack;
+    for (size_t i = 0; i < leaves.size(); i++) {
+        comb_resp_pack_q.pull(resp_pack);
+    }
+
+    size_t leaf = 0, node = 0;
+    res = KaratsubaMerge(products, splits, leaf, node);
+    if (sgn(a) * sgn(b) < 0) res = -res;
+}
+
+/*
+ * Newton iteration on F = A*Q + T, to x ≈ 2^(2m) * sqrt(k) / F_m with F ≈ F_m * 2^(e-m), m = m_final.
+ * k = 1 is the plain reciprocal, otherwise the fused inverse square root.
+ * The low precision steps only need the top bits of F, so a helper thread starts them from A*Q_top + T_top
+ * while master is still adding up the full F. The high precision steps send their products to the workers.
+ */
+void Chudnovsky::NewtonIterate(mpz_class& x, long& e, PQT& pqt, long m_final, unsigned long k) {
+    std::vector<long> ms = NewtonSchedule(m_final, 256);
+
+    // the steps below 1/8 of the final precision are early steps
+    size_t early = 1;
+    while (early < ms.size() && ms[early] * 8 <= m_final) early++;
+
+    // F ≈ F_top * 2^s, and the error is a few units of F_top, far below the precision of the early steps
+    long s = std::max(0L, static_cast<long>(mpz_sizeinbase(pqt.Q->get_mpz_t(), 2)) - ms[early-1] - 128);
+    mpz_class f_top = A_ * (*pqt.Q >> s) + (*pqt.T >> s);
+    e = mpz_sizeinbase(f_top.get_mpz_t(), 2) + s;
+
+    auto iterate = [&ms, k](mpz_class& x, const mpz_class& f, long e, size_t begin, size_t end, const MulFunc& mul) {
+        for (size_t i = begin; i < end; i++) {
+            if (k == 1) ReciprocalStep(x, f, e, ms[i-1], ms[i], mul);
+            else RecipSqrtStep(x, f, e, ms[i-1], ms[i], k, mul);
+        }
+    };
+
+    std::future<mpz_class> seed = std::async(std::launch::async, [&] {
+        MulFunc mul = [](mpz_class& res, const mpz_class& a, const mpz_class& b) {res = a * b;};
+        mpz_class x;
+        if (k == 1) ReciprocalSeed(x, f_top, e - s, ms[0]);
+        else RecipSqrtSeed(x, f_top, e - s, ms[0], k);
+        iterate(x, f_top, e - s, 1, early, mul);
+        return x;
+    });
+
+    mpz_class F = A_ * *pqt.Q + *pqt.T;
+
+    MulFunc mul = [this](mpz_class& res, const mpz_class& a, const mpz_class& b) {ParallelMultiply(res, a, b);};
+    x = seed.get();
+    iterate(x, F, e, early, ms.size(), mul);
+}
+
+/*
+ * Final division pi = D*Q / F by Newton reciprocal, sqrt(E) is left to PIWorker()
+ */
+void Chudnovsky::NewtonDivision(mpf_class& pi, PQT& pqt) {
+    const long m = PREC_ + 64;
+    mpz_class x, res, num = D_ * *pqt.Q;
+    long e;
+    NewtonIterate(x, e, pqt, m, 1);
+
+    // 1/F ≈ x / 2^(2m) / 2^(e-m)
+    ParallelMultiply(res, num, x);
+    mpf_set_z(pi.get_mpf_t(), res.get_mpz_t());
+    mpf_div_2exp(pi.get_mpf_t(), pi.get_mpf_t(), m + e);
+}
+
+/*
+ * Final stage in fixed point: pi = D*Q * sqrt(E)/F, where sqrt(E)/F comes from one fused Newton iteration,
+ * so there is no sqrt, no division, and a single full precision multiplication at the end.
+ * Returns pi * 2^frac_bits.
+ */
+mpz_class Chudnovsky::FixedPointFinal(PQT& pqt, long& frac_bits) {
+    const long m = PREC_ + 64;
+    mpz_class x, res, num = D_ * *pqt.Q;
+    long e;
+    NewtonIterate(x, e, pqt, m, E_.get_ui());
+
+    // sqrt(E)/F ≈ x / 2^(2m) / 2^(e-m)
+    frac_bits = PREC_ + 32;
+    ParallelMultiply(res, num, x);
+    res >>= (m + e - frac_bits);
+
+    return res;
+}
+
+/*
+ * pi from the root of the merge tree: into pi_fixed * 2^-frac_bits with FIXED_POINT_, otherwise into pi,
+ * whose sqrt(E) is computed by PIWorker() meanwhile.
+ */
+void Chudnovsky::FinalStage(PQT& pqt, mpf_class& pi, mpz_class& pi_fixed, long& frac_bits) {
+    if (FIXED_POINT_) {
+        pi_fixed = FixedPointFinal(pqt, frac_bits);
+        return;
+    }
+
+    RespPack resp_pack;
+    final_req_pack_q.push(ReqPack(1));
+    if (NEWTON_DIVISION_) {
+        NewtonDivision(pi, pqt);
+    } else {
+        mpf_class F(A_ * *pqt.Q + *pqt.T, PREC_);
+        pi = (D_ * *pqt.Q) / F;
+    }
+    final_resp_pack_q.pull(resp_pack);
+
+    pi *= *resp_pack.Getfa();
+}
+
+/*
+ * Write x / 2^frac_bits with DIGITS_ decimals, in the same format as mpf output.
+ * The binary to decimal conversion is done by the workers, see ConvertWorker(),
+ * and they write the digits directly into one shared buffer.
+ */
+void Chudnovsky::WriteOutput(const std::string& filename, const mpz_class& x, long frac_bits, std::shared_ptr<PiDigits>* text) {
+    TraceSpan span("output");
+    auto start = std::chrono::steady_clock::now();
+    long int_len;
+    std::shared_ptr<mpz_class> n = std::make_shared<mpz_class>(FixedPointToInteger(x, frac_bits, DIGITS_, int_len));
+    long total = int_len + DIGITS_;
+
+    // integer part, '.', decimals, '\n', in whole chunks so that every write is aligned
+    const long chunk = WRITER_CHUNK;
+    long num_chunks = (total + 2 + chunk - 1) / chunk;
+    std::unique_ptr<char, void (*)(void*)> buf(static_cast<char*>(std::aligned_alloc(WRITER_ALIGN, num_chunks * chunk)), std::free);
+    buf.get()[int_len] = '.';
+    out_buf_ = buf.get();
+    out_int_len_ = int_len;
+    CONVERT_TASK_DIGITS_ = std::max(1L << 16, total / (std::max(NUM_OF_CORES_, 1) * 4));
+    PowersOf10(pow10_, total);
+
+    // a chunk is written as soon as all its bytes are converted, while the other chunks are still being converted
+    // the last one waits for the trailing zeros to be trimmed
+    std::unique_ptr<AsyncWriter> writer(text ? nullptr : new AsyncWriter(filename));
+    std::vector<long> pending(num_chunks, chunk);
+    auto ready = [&](long begin, long end) {
+        for (long c = begin / chunk; writer && c * chunk < end; c++) {
+            pending[c] -= std::min(end, (c + 1) * chunk) - std::max(begin, c * chunk);
+            if (pending[c] == 0 && c < num_chunks - 1) writer->Submit(buf.get() + c * chunk, c * chunk, chunk);
+        }
+    };
+    ready(int_len, int_len + 1);
+
+    req_pack_q.push(ReqPack(0, 0, total, n));
+    n = nullptr;
+
+    RespPack resp_pack;
+    for (long done = 0; done < total; done += resp_pack.GetN2()) {
+        out_resp_pack_q.pull(resp_pack);
+        // digit i is at i, or at i+1 after the '.'
+        long begin = resp_pack.GetN1(), end = begin + resp_pack.GetN2();
+        if (begin < int_len) ready(begin, std::min(end, int_len));
+        if (end > int_len) ready(std::max(begin, int_len) + 1, end + 1);
+    }
+    pow10_.clear();
+    out_buf_ = nullptr;
+    auto converted = std::chrono::steady_clock::now();
+    // the chunk holding the end of the text may already be in flight, since trimming can move the end into an earlier one
+    if (writer) writer->Wait();
+
+    long len = TrimDigits(buf.get(), int_len, DIGITS_);
+    buf.get()[len] = '\n';
+    if (text) {
+        *text = std::make_shared<PiDigits>(std::shared_ptr<const char>(buf.release(), std::free), len, DIGITS_);
+        double ms = std::chrono::duration<double, std::milli>(converted - start).count();
+        std::cerr << " [*] Output: " << (len + 1) / 1e6 << " MB, " << (len + 1) / 1e3 / std::max(ms, 1e-3) << " MB/s (memory)" << std::endl;
+        return;
+    }
+    std::string backend = writer->Describe();
+    // write from the chunk holding the end of the text, padded to an aligned length, the file is cut at len + 1 afterwards
+    long tail = std::min(len / chunk, num_chunks - 1) * chunk;
+    long tail_len = (len + 1 - tail + WRITER_ALIGN - 1) / WRITER_ALIGN * WRITER_ALIGN;
+    memset(buf.get() + len + 1, 0, tail + tail_len - len - 1);
+    writer->Submit(buf.get() + tail, tail, tail_len);
+    if (!writer->Finish(len + 1)) {
+        std::cerr << " [*] Cannot write " << filename << std::endl;
+        return;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    double wait_ms = std::chrono::duration<double, std::milli>(end - converted).count();
+    std::cerr << " [*] Output: " << (len + 1) / 1e6 << " MB, " << (len + 1) / 1e3 / std::max(ms, 1e-3) << " MB/s, "
+              << wait_ms << " ms after conversion (" << backend << ")" << std::endl;
+}
+
 /*
  * Compute PI: Single Thread
  */
 void Chudnovsky::Start(bool nout) {
-    // BATCH_NUM must be the power of 2, get the leftmost bit
-    BATCH_NUM_ = static_cast<int>(GetBatchNum(NUM_OF_CORES_)) * 8;
-    BATCH_SIZE_ = (N_ / BATCH_NUM_) + 1;
-
     std::cerr << " [*] PI with " << DIGITS_ << " digits" << std::endl;
 
     // Time (start)
     ClockStart();
+    ResetAllocStats();
+    PrepareFactorRemoval();
 
     // Compute Pi
-    NativePQT native_pqt = ComputePQT(0, N_);
+    TraceThread("master");
+    NativePQT native_pqt;
+    {
+        TraceSpan span("single: tree");
+        native_pqt = ComputePQT(0, N_);
+    }
     mpf_class pi(0, PREC_);
-    pi = D_ * sqrt((mpf_class)E_) * native_pqt.Q;
-    pi /= (A_ * native_pqt.Q + native_pqt.T);
+    {
+        TraceSpan span("single: final");
+        pi = D_ * sqrt((mpf_class)E_) * native_pqt.Q;
+        pi /= (A_ * native_pqt.Q + native_pqt.T);
+    }
 
     // Time (end of computation)
     ClockEnd(0);
+    PrintAllocStats();
     ClockStart();
 
     // Output // +1 for dot
     if (!nout) {
-        std::ofstream ofs ("pi_normal.txt");
-        ofs.precision(DIGITS_ + 1);
-        ofs << pi << std::endl;
-        ofs.close();
+        long frac_bits;
+        mpz_class pi_fixed = MpfToFixedPoint(pi, frac_bits);
+        WriteOutput("pi_normal.txt", pi_fixed, frac_bits);
     }
 
     // Time (end of writing)
@@ -497,9 +1511,82 @@ void Chudnovsky::Start(bool nout) {
  * Compute PI: Multithread
  */
 void Chudnovsky::StartConcurrent(bool nout) {
-    // BATCH_NUM must be the power of 2, get the leftmost bit
-    BATCH_NUM_ = static_cast<int>(GetBatchNum(NUM_OF_CORES_)) * 8;
-    BATCH_SIZE_ = (N_ / BATCH_NUM_) + 1;
+    mpz_class pi_fixed;
+    long frac_bits = 0;
+    if (!ComputeConcurrent(!nout || HEX_TAIL_ > 0, pi_fixed, frac_bits)) return;
+    if (HEX_TAIL_ > 0) WriteHexTail("pi_hex.txt", pi_fixed, frac_bits);
+
+    // Output // +1 for dot
+    if (!nout) WriteOutput("pi_concurrent.txt", pi_fixed, frac_bits);
+
+    // Time (end of writing)
+    ClockEnd(0);
+}
+
+/*
+ * Write the last HEX_TAIL_ hex digits of x / 2^frac_bits which are within the precision as "{first} {digits}",
+ * first being the number of hex digits before them, for the verifier to check them with the BBP formula.
+ */
+void Chudnovsky::WriteHexTail(const std::string& filename, const mpz_class& x, long frac_bits) {
+    // pi is rounded at PREC_ bits, the guard bits keep the rounding out of the digits unless a run of 0s or 1s reaches them
+    long last = std::min(static_cast<long>(PREC_) - HEX_GUARD_BITS, frac_bits) / 4;
+    long first = std::max(last - HEX_TAIL_, 0L);
+    if (last <= first) {
+        std::cerr << " [X] Too few digits for a hex tail" << std::endl;
+        return;
+    }
+    std::ofstream ofs(filename);
+    ofs << first << " " << HexDigits(x, frac_bits, first, last - first) << std::endl;
+    if (!ofs) std::cerr << " [X] Cannot write " << filename << std::endl;
+    else std::cerr << " [*] Hex digits [" << first << ", " << last << ") written to " << filename << std::endl;
+}
+
+/*
+ * Compute PI: Multithread, into memory instead of a file, nullptr if it is cancelled
+ */
+std::shared_ptr<PiDigits> Chudnovsky::ComputeDigits() {
+    mpz_class pi_fixed;
+    long frac_bits = 0;
+    if (!ComputeConcurrent(true, pi_fixed, frac_bits)) return nullptr;
+
+    std::shared_ptr<PiDigits> text;
+    if (progress_) progress_("output", 0);
+    WriteOutput("", pi_fixed, frac_bits, &text);
+
+    // Time (end of conversion)
+    ClockEnd(0);
+
+    return text;
+}
+
+/*
+ * The computation of the multithread mode, up to pi as a fixed point number if fixed.
+ * The clock of the output is started on return, unless it is cancelled, then false is returned.
+ */
+bool Chudnovsky::ComputeConcurrent(bool fixed, mpz_class& pi_fixed, long& frac_bits) {
+    TraceThread("master");
+    modcheck_.reset(MODCHECK_PRIMES_ > 0 ? new ModCheck(MODCHECK_PRIMES_) : nullptr);
+    // the batches are not partitioned yet, so the pool has the nodes of the largest merge tree, with 8 batches per worker
+    long nodes = 1;
+    for (int size = NUM_OF_CORES_ * 8; size > 1; size = (size + 1) >> 1) {
+        nodes += size;
+    }
+    pool_.Reset(nodes + 2);
+    unreleased_.clear();
+    LoadBase();
+    if (TRUNCATE_ && !SAVE_ROOT_.empty()) {
+        std::cerr << " [*] The root to save must be exact, the merges are not truncated" << std::endl;
+        TRUNCATE_ = false;
+    }
+    TRUNCATE_BITS_ = PREC_ + TRUNCATE_GUARD_BITS;
+    // any number of batches, 8 per worker, of about the same cost
+    PartitionBatches();
+    // every level has half of the subtrees of the level below, rounded up
+    finished_subtrees_ = 0;
+    total_subtrees_ = 1;
+    for (int size = BATCH_NUM_; size > 1; size = (size + 1) >> 1) {
+        total_subtrees_ += size;
+    }
 
     std::cerr << " [*] PI with " << DIGITS_ << " digits" << std::endl;
 
@@ -508,39 +1595,114 @@ void Chudnovsky::StartConcurrent(bool nout) {
 
     // Compute Pi
     RespPack resp_pack;
-    PQT pqt;
+    PQT* pqt;
+    req_pack_q.ResetStats();
+    ResetAllocStats();
+    PrepareFactorRemoval();
+    if (!CACHE_DIR_.empty()) {
+        // the common factors removed by -g change P, Q and T of the same terms
+        std::string constants = A_.get_str() + "," + B_.get_str() + "," + C_.get_str() + (sieve_ ? ",g" : "");
+        cache_.reset(new PQTCache(CACHE_DIR_, constants, CACHE_BUDGET_));
+    }
+    if (!CHECKPOINT_DIR_.empty()) checkpoint_.reset(new Checkpoint(CHECKPOINT_DIR_, DIGITS_, BATCH_NUM_, RESUME_));
+    if (SPILL_BUDGET_ > 0) {
+        spill_.reset(new SpillStore(SPILL_BUDGET_, SPILL_DIRS_));
+        // a subtree must not be spilled while it is being checkpointed
+        if (checkpoint_) spill_->SetBeforeSpill([this](PQT* pqt) {checkpoint_->WaitWritten(pqt);});
+    }
 
     // Choose version
-    if (VERSION_ == 1) pqt = PQTMasterV1();
+    std::unique_ptr<TraceSpan> tree_span(new TraceSpan("tree"));
+    if (FIRST_TERM_ >= N_) pqt = base_;
+    else if (VERSION_ == 1) pqt = PQTMasterV1();
     else if (VERSION_ == 2) pqt = PQTMasterV2();
     else if (VERSION_ == 3) pqt = PQTMasterV3();
+    else if (VERSION_ == 4) pqt = PQTMasterV4();
     else {
         std::cerr << " [*] No such version = " << VERSION_ << std::endl;
         // Time (end because of error)
         ClockEnd(0);
-        return;
+        pool_.Clear();
+        return false;
+    }
+    if (spill_) {
+        SpillStore::Stats spill_stats = spill_->GetStats();
+        std::cerr << " [*] Spill: held peak(MB) = " << (spill_stats.peak >> 20) << ", written(MB) = " << (spill_stats.written >> 20)
+                  << ", read(MB) = " << (spill_stats.read >> 20) << ", stall(ms) = " << spill_stats.stall_ms << std::endl;
+        spill_.reset();
+    }
+    if (checkpoint_) {
+        checkpoint_->Flush();
+        checkpoint_.reset();
+    }
+    ReleasePQT(nullptr);
+    // the workers went through the rest of the tree without computing anything
+    if (cancelled_) {
+        base_ = nullptr;
+        pool_.Clear();
+        cache_.reset();
+        std::cerr << " [*] Cancelled" << std::endl;
+        // Time (end because of cancellation)
+        ClockEnd(0);
+        return false;
+    }
+    // the new terms are merged to the right of the previous root, with one more combine on the workers
+    if (base_ && FIRST_TERM_ < N_) {
+        RespPack left(0, 0, FIRST_TERM_, base_), right(1, FIRST_TERM_, N_, pqt);
+        pqt = CombinePQTMasterV1(left, right, NEED_ROOT_P_, pool_.Node(pool_.Size() - 1)).GetResult();
+    }
+    base_ = nullptr;
+    if (modcheck_) {
+        // P of the right spine is not multiplied unless the root is saved, it stays 0 as its residues
+        std::array<Residues, 3> mod;
+        modcheck_->Of(*pqt, mod);
+        std::cerr << " [*] Modular check: primes = " << modcheck_->Count() << ", products = " << modcheck_->Checked()
+                  << ", failed = " << modcheck_->Failed() << ", root " << (mod == pqt->mod ? "verified" : "MISMATCH") << std::endl;
+        if (mod != pqt->mod) std::cerr << " [X] P, Q, T of the root do not match the residues of the merge tree, the digits are not reliable" << std::endl;
+    }
+    if (TRUNCATE_) {
+        TruncatePQT(*pqt, TRUNCATE_BITS_);
+        double bound = PiErrorBound(*pqt, A_);
+        std::cerr << " [*] Truncated merges: Q bits = " << mpz_sizeinbase(pqt->Q->get_mpz_t(), 2);
+        if (std::isinf(bound)) std::cerr << ", nothing truncated" << std::endl;
+        else std::cerr << ", error of pi < 2^" << -static_cast<long>(-bound) << std::endl;
+        // the final stage rounds at PREC_ bits, the guard bits keep the truncation far below it
+        if (bound > -PREC_ - TRUNCATE_GUARD_BITS / 2) std::cerr << " [X] The error of the truncated merges may change the last digits" << std::endl;
     }
 
-    // multithread this part
-    final_req_pack_q.push(ReqPack(1));
-    mpf_class F(A_ * *pqt.Q + *pqt.T, PREC_);
-    mpf_class pi((D_ * *pqt.Q) / F, PREC_);
-    final_resp_pack_q.pull(resp_pack);
+    tree_span.reset();
 
-    pi *= *resp_pack.Getfa();
+    // multithread this part
+    if (progress_) progress_("final", 0);
+    mpf_class pi(0, PREC_);
+    {
+        TraceSpan span("final");
+        FinalStage(*pqt, pi, pi_fixed, frac_bits);
+    }
 
     // Time (end of computation)
     ClockEnd(0);
+    WorkStealingScheduler<ReqPack>::Stats stats = req_pack_q.GetStats();
+    std::cerr << " [*] Scheduler: tasks = " << stats.pulls << ", steals = " << stats.steals << ", idle(ms) = " << stats.idle_ms << std::endl;
+    PQTPool::Stats pool_stats = pool_.GetStats();
+    std::cerr << " [*] PQT pool: nodes = " << pool_stats.nodes << ", reserved products = " << pool_stats.reserved << ", reserved(MB) = "
+              << (pool_stats.reserved_bytes >> 20) << ", regrown = " << pool_stats.regrown << std::endl;
+    if (cache_) {
+        PQTCache::Stats cache_stats = cache_->GetStats();
+        std::cerr << " [*] Subtree cache: hits = " << cache_stats.hits << ", misses = " << cache_stats.misses << ", stored = " << cache_stats.stored
+                  << ", evicted = " << cache_stats.evicted << ", size(MB) = " << (cache_stats.bytes >> 20) << std::endl;
+        cache_.reset();
+    }
+    PrintAllocStats();
     ClockStart();
 
-    // Output // +1 for dot
-    if (!nout) {
-        std::ofstream ofs ("pi_concurrent.txt");
-        ofs.precision(DIGITS_ + 1);
-        ofs << pi << std::endl;
-        ofs.close();
+    if (!SAVE_ROOT_.empty()) {
+        int n = std::max(FIRST_TERM_, N_);
+        if (SaveRoot(SAVE_ROOT_, n, *pqt)) std::cerr << " [*] Saved the root of " << n << " terms to " << SAVE_ROOT_ << std::endl;
+        else std::cerr << " [X] Cannot save the root to " << SAVE_ROOT_ << (sgn(*pqt->P) == 0 ? ", its P was not multiplied" : "") << std::endl;
     }
+    pool_.Clear();
+    if (fixed && !FIXED_POINT_) pi_fixed = MpfToFixedPoint(pi, frac_bits);
 
-    // Time (end of writing)
-    ClockEnd(0);
+    return true;
 }
@@ -1,15 +1,58 @@
+#pragma once
+
+#include <atomic>
 #include <cmath>
+#include <functional>
 #include <iostream>
 #include <fstream>
+#include <queue>
 #include <vector>
 #include <thread>
 
 #include "utils.hpp"
+#include "ntt.hpp"
+#include "scheduler.hpp"
+#include "mpmc_queue.hpp"
+#include "newton.hpp"
+#include "output.hpp"
+#include "writer.hpp"
+#include "spill.hpp"
+#include "checkpoint.hpp"
+#include "alloc.hpp"
+#include "pool.hpp"
+#include "leaf.hpp"
+#include "factor.hpp"
+#include "truncate.hpp"
+#include "cache.hpp"
+#include "modcheck.hpp"
 
 #include <gmpxx.h>
-#include <boost/thread/sync_queue.hpp>
+
+// a node of the merge tree of version 4: a leaf batch, or the merge of its 2 children
+struct DagNode {
+    // its node of the pool, once it is computed or its first product is sent
+    PQT* pqt;
+    int left, right, parent, worker;
+    int n1, n2;
+    // (level size, index) of the subtree in every merge level it belongs to, more than one if it is carried up
+    std::vector<std::pair<size_t, int>> levels;
+    // P, Q, T exist, products (P, Q, T1, T2) sent and done, read by a product of the parent
+    bool ready[3], sent[4], done[4], read;
+    // estimated cost from the output of this node to the root
+    double tail;
+};
+
+// a ready task of version 4: the product k of node, or the leaf batch node if k < 0
+struct DagTask {
+    double priority;
+    int node, k;
+    bool operator<(const DagTask& other) const {return priority < other.priority;}
+};
 
 class Chudnovsky {
+    // the microbenchmarks of bench.cpp time the stages one by one
+    friend class ChudnovskyBench;
+
     // constants for Chudnovsky Algorithm
     mpz_class A_, B_, C_, D_, E_, C3_24_;
     int DIGITS_, PREC_, N_, VERSION_;
@@ -17,51 +60,169 @@ class Chudnovsky {
 
     // for concurrency
     volatile bool terminated;
+    // a cancelled run goes on through all its tasks, which return empty results, so the workers stay in step with master
+    std::atomic<bool> cancelled_;
     bool debug;
-    int NUM_OF_CORES_, BATCH_SIZE_, BATCH_NUM_;
-    boost::sync_queue<ReqPack> req_pack_q;
-    boost::sync_queue<RespPack> comb_resp_pack_q;
-    boost::sync_queue<RespPack> comp_resp_pack_q;
-    boost::sync_queue<RespPack> comp2_resp_pack_q;
-    boost::sync_queue<ReqPack> final_req_pack_q;
-    boost::sync_queue<RespPack> final_resp_pack_q;
+    int NUM_OF_CORES_, BATCH_NUM_;
+    // batch i computes the terms [BATCH_BOUNDS_[i], BATCH_BOUNDS_[i+1])
+    std::vector<int> BATCH_BOUNDS_;
+    // operand size (in limbs) from which the multithreaded NTT takes over GMP, 0 to disable
+    size_t NTT_THRESHOLD_;
+    // use Newton reciprocal instead of mpf division in the final stage
+    bool NEWTON_DIVISION_;
+    // use the fused fixed point final stage instead of mpf
+    bool FIXED_POINT_;
+    // cancel the common factors of P and Q in ComputePQT(), with the factors of the terms from sieve_
+    bool FACTOR_REMOVAL_;
+    std::unique_ptr<FactorSieve> sieve_;
+    FacList C3_24_FAC_;
+    // the root is saved to SAVE_ROOT_ if not empty, which needs P of the right spine, and the root of EXTEND_ROOT_,
+    // the terms [0, FIRST_TERM_) of a previous run, is merged with the batches of [FIRST_TERM_, N_) if not empty
+    std::string SAVE_ROOT_, EXTEND_ROOT_;
+    bool NEED_ROOT_P_;
+    int FIRST_TERM_;
+    PQT* base_;
+    // operands of the merges and the root keep TRUNCATE_BITS_ bits of Q, pi is checked against the bound of the error
+    bool TRUNCATE_;
+    long TRUNCATE_BITS_;
+    // hex digits at the end of the precision written to pi_hex.txt, for the BBP check of the verifier
+    long HEX_TAIL_;
+    // RAM budget (bytes) of the PQT held between merge levels, the rest is spilled to SPILL_DIRS_, 0 to keep all in memory
+    size_t SPILL_BUDGET_;
+    std::vector<std::string> SPILL_DIRS_;
+    std::unique_ptr<SpillStore> spill_;
+    // finished subtrees are checkpointed to CHECKPOINT_DIR_ if not empty, and reloaded first if RESUME_
+    std::string CHECKPOINT_DIR_;
+    bool RESUME_;
+    std::unique_ptr<Checkpoint> checkpoint_;
+    // the batches are looked up in the persistent cache in CACHE_DIR_ if not empty, and new ones are stored
+    // within CACHE_BUDGET_ bytes, 0 to only read it
+    std::string CACHE_DIR_;
+    size_t CACHE_BUDGET_;
+    std::unique_ptr<PQTCache> cache_;
+    // the products of the merges are checked modulo MODCHECK_PRIMES_ primes, 0 for none
+    int MODCHECK_PRIMES_;
+    std::unique_ptr<ModCheck> modcheck_;
+    // called by master with the stage ("tree", "final", "output") and the fraction of the subtrees of the tree finished
+    std::function<void(const std::string&, double)> progress_;
+    long finished_subtrees_, total_subtrees_;
+    WorkStealingScheduler<ReqPack> req_pack_q;
+    PackQueue<RespPack> comb_resp_pack_q;
+    PackQueue<RespPack> comp_resp_pack_q;
+    PackQueue<RespPack> comp2_resp_pack_q;
+    PackQueue<ReqPack> final_req_pack_q;
+    PackQueue<RespPack> final_resp_pack_q;
+    PackQueue<RespPack> out_resp_pack_q;
+
+    // for output, shared with workers during conversion
+    std::vector<mpz_class> pow10_;
+    char* out_buf_;
+    long out_int_len_, CONVERT_TASK_DIGITS_;
+
+    // P, Q, T of every subtree of the run, which workers write in place: the nodes of the largest merge tree by merge order,
+    // then the root of EXTEND_ROOT_ and its merge with the new root
+    PQTPool pool_;
+    // children whose limbs are freed once the checkpoint has written them
+    std::vector<PQT*> unreleased_;
+    // the operands (children) of one merge level, kept by master until the products of their parent are done
+    std::vector<PQT*> operands_;
+
+    // merge tree of version 4, its ready tasks by critical path, and the number of tasks sent to workers
+    std::vector<DagNode> dag_;
+    std::priority_queue<DagTask> dag_ready_;
+    int dag_in_flight_;
 
     std::vector<std::thread> pqt_workers;
     std::thread pi_worker;
 
     void PIWorker();
+    void Multiply(mpz_class& res, const mpz_class& a, const mpz_class& b);
+    void CheckedMultiply(mpz_class& res, const mpz_class& a, const mpz_class& b, const Residues* ra, const Residues* rb, Residues* rout);
+    ReqPack ProductRequest(int id, const PQT& left, int a, const PQT& right, int b, mpz_class* out, Residues* out_mod);
+    void AddT2(PQT& res);
+    void ParallelMultiply(mpz_class& res, const mpz_class& a, const mpz_class& b);
+    void NewtonIterate(mpz_class& x, long& e, PQT& pqt, long m_final, unsigned long k);
+    void NewtonDivision(mpf_class& pi, PQT& pqt);
+    mpz_class FixedPointFinal(PQT& pqt, long& frac_bits);
+    void FinalStage(PQT& pqt, mpf_class& pi, mpz_class& pi_fixed, long& frac_bits);
+    void WriteOutput(const std::string& filename, const mpz_class& x, long frac_bits, std::shared_ptr<PiDigits>* text = nullptr);
+    void WriteHexTail(const std::string& filename, const mpz_class& x, long frac_bits);
+    bool ComputeConcurrent(bool fixed, mpz_class& pi_fixed, long& frac_bits);
+    double BatchCost(int n1, int n2);
+    void PartitionBatches();
+    size_t LoadCheckpoint(std::vector<RespPack>& finished);
+    RespPack ComputeSubtree(size_t level_size, int id);
+    size_t SendBatches();
+    long SubtreeRange(size_t level_size, int id, int& n1, int& n2);
+    PQT* SubtreePQT(size_t level_size, int id);
+    void ReleasePQT(PQT* pqt);
+    void FinishPQT(RespPack& resp_pack, size_t level_size, bool hold = true);
+    RespPack CarryPQT(RespPack& resp_pack, size_t level_size);
+    void AcquirePQT(RespPack& resp_pack);
+    void TruncateOperand(PQT& pqt);
     // Version 0 Entry.
     NativePQT ComputePQT(int n1, int n2);
+    NativePQT ComputeLeafPQT(int n1, int n2);
+    NativePQT ComputePQTFactored(int n1, int n2, TermFactors& terms, FacList& fp, FacList& fq);
+    void PrepareFactorRemoval();
+    void LoadBase();
     // Version 1 Entry.
-    PQT PQTMasterV1();
+    PQT* PQTMasterV1();
     // Version 2 Entry.
-    PQT PQTMasterV2();
+    PQT* PQTMasterV2();
     // Version 3 Entry.
-    PQT PQTMasterV3();
+    PQT* PQTMasterV3();
+    // Version 4 Entry.
+    PQT* PQTMasterV4();
 
     // Version 1 Impl.
-    PQT ComputePQTMasterV1();
-    RespPack CombinePQTMasterV1(RespPack& rp1, RespPack& rp2);
-    void PQTWorkerV1();
+    PQT* ComputePQTMasterV1(size_t level_size);
+    RespPack CombinePQTMasterV1(RespPack& rp1, RespPack& rp2, bool need_p, PQT* res);
+    void PQTWorkerV1(int worker_no);
+    void ConvertWorker(ReqPack& req_pack);
 
     // Version 2 Impl.
-    PQT ComputePQTMasterV2();
-    void CombinePQTMasterV2(std::vector<RespPack>& resp_packs, size_t resp_packs_size);
-    void CombinePQTSenderV2(RespPack& rp1, RespPack& rp2);
-    PQT CombinePQTMergerV2(std::vector<RespPack>& resp_packs, int sliding_window_begin);
+    PQT* ComputePQTMasterV2(size_t level_size);
+    void CombinePQTMasterV2(std::vector<RespPack>& resp_packs, size_t pairs);
+    void CombinePQTSenderV2(RespPack& rp1, RespPack& rp2, bool need_p, PQT* res);
     bool CombinePQTCheckResultV2(std::vector<RespPack>& resp_packs, int sliding_window_begin, int sliding_window_end);
 
     // Version 3 Impl.
-    PQT ComputePQTMasterV3();
-    void CombinePQTMasterV3(std::vector<RespPack>& parent_resp_packs, size_t resp_packs_size);
-    void Combine2PQTSenderV3(int id, std::vector<RespPack>& resp_packs, int index);
+    PQT* ComputePQTMasterV3(size_t level_size);
+    void CombinePQTMasterV3(std::vector<RespPack>& parent_resp_packs, size_t pairs);
+    void Combine2PQTSenderV3(int id, PQT* res, std::vector<RespPack>& resp_packs, int index);
+
+    // Version 4 Impl.
+    int BuildDagV4(size_t level_size);
+    double ComponentBitsV4(int node, int component);
+    void ReadyDagV4(int node, int component);
+    void FinishDagV4(int node);
+    void DispatchDagV4();
 
 public:
     Chudnovsky() = delete;
-    Chudnovsky(int version, int digits, int worker_num);
+    Chudnovsky(int version, int digits, int worker_num, QueueKind queue_kind = DEFAULT_QUEUE_KIND);
     ~Chudnovsky();
 
+    void SetDigits(int digits);
+    void SetVersion(int version);
+    void SetProgress(const std::function<void(const std::string&, double)>& progress);
+    // thread-safe, the running StartConcurrent() or ComputeDigits() stops as soon as possible
+    void SetCancelled(bool cancelled);
+    void SetNTTThreshold(long limbs);
+    void SetNewtonDivision(bool enabled);
+    void SetFixedPoint(bool enabled);
+    void SetFactorRemoval(bool enabled);
+    void SetTruncate(bool enabled);
+    void SetHexTail(long count);
+    void SetModCheck(int primes);
+    void SetSpill(long budget_mb, const std::vector<std::string>& dirs);
+    void SetCheckpoint(const std::string& dir, bool resume);
+    void SetSaveRoot(const std::string& path);
+    void SetExtendRoot(const std::string& path);
+    void SetCache(const std::string& dir, long budget_mb);
     void Start(bool nout);
     void StartConcurrent(bool nout);
+    std::shared_ptr<PiDigits> ComputeDigits();
     void Stop();
 };
@@ -0,0 +1,157 @@
+#include "engine.hpp"
+
+bool PiOptions::operator==(const PiOptions& other) const {
+    return version == other.version && fixed_point == other.fixed_point && newton_division == other.newton_division
+        && factor_removal == other.factor_removal && truncate == other.truncate && save_root == other.save_root && extend_root == other.extend_root;
+}
+
+// one computation, shared by the tasks of the same digits and options
+struct PiTask::Job {
+    int digits;
+    PiOptions options;
+    std::promise<std::shared_ptr<const PiDigits>> promise;
+    PiFuture future;
+    std::vector<PiProgress> progress;
+    // tasks not cancelled
+    int tasks;
+};
+
+// the engine of the tasks, cleared by the engine before it is destroyed, mtx is held while a task cancels through it
+struct PiTask::Link {
+    std::mutex mtx;
+    PiEngine* engine;
+};
+
+PiTask::PiTask(const std::shared_ptr<Link>& link, const std::shared_ptr<Job>& job): link_(link), job_(job), cancelled_(false) {}
+
+PiTask::~PiTask() {
+    Cancel();
+}
+
+PiFuture PiTask::Future() const {
+    return job_->future;
+}
+
+void PiTask::Cancel() {
+    if (cancelled_) return;
+    cancelled_ = true;
+    // a finished computation has nothing to stop, and the engine cancels the rest when it is destroyed
+    if (job_->future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) return;
+    std::shared_ptr<Link> link = link_.lock();
+    if (!link) return;
+    std::lock_guard<std::mutex> lock(link->mtx);
+    if (link->engine) link->engine->Cancel(job_);
+}
+
+PiEngine::PiEngine(int worker_num, QueueKind queue_kind): calc_(2, 0, worker_num, queue_kind), link_(std::make_shared<PiTask::Link>()), stop_(false) {
+    link_->engine = this;
+    dispatcher_ = std::thread(&PiEngine::Dispatch, this);
+}
+
+PiEngine::~PiEngine() {
+    {
+        std::lock_guard<std::mutex> lock(link_->mtx);
+        link_->engine = nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+        for (auto& job: jobs_) {
+            job->promise.set_exception(std::make_exception_ptr(PiCancelled()));
+        }
+        jobs_.clear();
+        if (running_) calc_.SetCancelled(true);
+    }
+    cv_.notify_all();
+    dispatcher_.join();
+}
+
+std::unique_ptr<PiTask> PiEngine::Compute(int digits, const PiOptions& options, const PiProgress& progress) {
+    if (digits < 0) throw std::invalid_argument("negative number of digits");
+    if (options.version < 1 || options.version > 4) throw std::invalid_argument("no such version = " + std::to_string(options.version));
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (stop_) throw PiCancelled();
+    std::shared_ptr<PiTask::Job> job;
+    if (running_ && running_->tasks > 0 && running_->digits == digits && running_->options == options) job = running_;
+    for (auto& queued: jobs_) {
+        if (!job && queued->digits == digits && queued->options == options) job = queued;
+    }
+    if (!job) {
+        job = std::make_shared<PiTask::Job>();
+        job->digits = digits;
+        job->options = options;
+        job->future = job->promise.get_future().share();
+        job->tasks = 0;
+        jobs_.push_back(job);
+        cv_.notify_one();
+    }
+    job->tasks++;
+    if (progress) job->progress.push_back(progress);
+
+    return std::unique_ptr<PiTask>(new PiTask(link_, job));
+}
+
+void PiEngine::Cancel(const std::shared_ptr<PiTask::Job>& job) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (--job->tasks > 0) return;
+    if (job == running_) {
+        calc_.SetCancelled(true);
+        return;
+    }
+    for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+        if (*it != job) continue;
+        jobs_.erase(it);
+        job->promise.set_exception(std::make_exception_ptr(PiCancelled()));
+        break;
+    }
+}
+
+void PiEngine::Dispatch() {
+    while (true) {
+        std::shared_ptr<PiTask::Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait(lock, [this]() {return stop_ || !jobs_.empty();});
+            if (stop_) break;
+            job = jobs_.front();
+            jobs_.pop_front();
+            running_ = job;
+            calc_.SetCancelled(false);
+        }
+        Run(job);
+        std::lock_guard<std::mutex> lock(mtx_);
+        running_.reset();
+    }
+}
+
+void PiEngine::Run(const std::shared_ptr<PiTask::Job>& job) {
+    calc_.SetDigits(job->digits);
+    calc_.SetVersion(job->options.version);
+    calc_.SetFixedPoint(job->options.fixed_point);
+    calc_.SetNewtonDivision(job->options.newton_division);
+    calc_.SetFactorRemoval(job->options.factor_removal);
+    calc_.SetTruncate(job->options.truncate);
+    calc_.SetSaveRoot(job->options.save_root);
+    calc_.SetExtendRoot(job->options.extend_root);
+    // the callbacks of the tasks joining the computation while it runs are called too
+    calc_.SetProgress([this, job](const std::string& stage, double done) {
+        std::vector<PiProgress> progress;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            progress = job->progress;
+        }
+        for (auto& callback: progress) {
+            callback(stage, done);
+        }
+    });
+
+    try {
+        std::shared_ptr<PiDigits> text = calc_.ComputeDigits();
+        if (!text) throw PiCancelled();
+        job->promise.set_value(text);
+    } catch (...) {
+        job->promise.set_exception(std::current_exception());
+    }
+    calc_.SetProgress(nullptr);
+}
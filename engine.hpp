@@ -0,0 +1,92 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chudnovsky.hpp"
+
+// options of one computation of PiEngine, as the flags of the command line
+struct PiOptions {
+    int version = 2;
+    bool fixed_point = false, newton_division = false, factor_removal = false, truncate = false;
+    // -save and -extend
+    std::string save_root, extend_root;
+
+    bool operator==(const PiOptions& other) const;
+};
+
+// the error of the future of a cancelled computation
+class PiCancelled: public std::runtime_error {
+public:
+    PiCancelled(): std::runtime_error("pi computation cancelled") {}
+};
+
+typedef std::function<void(const std::string&, double)> PiProgress;
+typedef std::shared_future<std::shared_ptr<const PiDigits>> PiFuture;
+
+class PiEngine;
+
+// handle of one call of PiEngine::Compute(), it may outlive the engine
+class PiTask {
+    friend class PiEngine;
+    struct Job;
+    struct Link;
+
+    // expired, or without engine, once the engine is destroyed
+    std::weak_ptr<Link> link_;
+    std::shared_ptr<Job> job_;
+    bool cancelled_;
+
+    PiTask(const std::shared_ptr<Link>& link, const std::shared_ptr<Job>& job);
+
+public:
+    // a task dropped is cancelled, so keep it until its future is ready
+    ~PiTask();
+    PiTask(const PiTask&) = delete;
+    PiTask& operator=(const PiTask&) = delete;
+
+    PiFuture Future() const;
+    // the computation is stopped once every task sharing it is cancelled, its future throws PiCancelled
+    void Cancel();
+};
+
+/*
+ * Embeddable pi engine: one long-lived Chudnovsky, whose workers stay up between the computations,
+ * and a dispatcher thread running the queued computations one after the other into memory.
+ * Compute() with the same digits and options as a queued or running computation joins it instead of queuing another one.
+ */
+class PiEngine {
+    friend class PiTask;
+
+    Chudnovsky calc_;
+    std::shared_ptr<PiTask::Link> link_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<PiTask::Job>> jobs_;
+    std::shared_ptr<PiTask::Job> running_;
+    bool stop_;
+    std::thread dispatcher_;
+
+    void Dispatch();
+    void Run(const std::shared_ptr<PiTask::Job>& job);
+    void Cancel(const std::shared_ptr<PiTask::Job>& job);
+
+public:
+    explicit PiEngine(int worker_num = -1, QueueKind queue_kind = DEFAULT_QUEUE_KIND);
+    // the queued and the running computations are cancelled
+    ~PiEngine();
+    PiEngine(const PiEngine&) = delete;
+    PiEngine& operator=(const PiEngine&) = delete;
+
+    // pi with the given decimals, progress is called by the engine with the stage and the fraction of the tree done
+    std::unique_ptr<PiTask> Compute(int digits, const PiOptions& options = PiOptions(), const PiProgress& progress = nullptr);
+};
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cmath>
+
+#include "factor.hpp"
+
+// x^-1 mod p, p prime and x not a multiple of p
+static uint32_t InverseMod(uint32_t x, uint32_t p) {
+    uint64_t res = 1, base = x % p;
+    for (uint32_t e = p - 2; e > 0; e >>= 1) {
+        if (e & 1) res = res * base % p;
+        base = base * base % p;
+    }
+
+    return res;
+}
+
+FactorSieve::FactorSieve(uint32_t limit): limit_(limit) {
+    uint32_t root = std::sqrt(static_cast<double>(limit)) + 1;
+    std::vector<bool> composite(root + 1, false);
+    for (uint32_t i = 2; i <= root; i++) {
+        if (composite[i]) continue;
+        primes_.push_back(i);
+        inv2_.push_back(i > 2 ? InverseMod(2, i) : 0);
+        inv6_.push_back(i > 3 ? InverseMod(6, i) : 0);
+        for (uint64_t j = static_cast<uint64_t>(i) * i; j <= root; j += i) {
+            composite[j] = true;
+        }
+    }
+}
+
+TermFactors::TermFactors(const FactorSieve& sieve, int last): sieve_(sieve), begin_(0), end_(0), last_(last) {}
+
+/*
+ * Factor the window (begin, begin + TERM_FACTORS_WINDOW], each of 2k-1, 6k-1, 6k-5 and k is a progression a*k - b,
+ * whose multiples of p are every p terms from the first k = b / a mod p. 2 and 3 never divide 2k-1, 6k-1 and 6k-5.
+ */
+void TermFactors::Sieve(int begin) {
+    struct Hit {
+        uint32_t i, p, e;
+    };
+    struct Progression {
+        uint32_t a, b, exp;
+        const std::vector<uint32_t>* inv;
+        bool q;
+    };
+    const Progression progressions[4] = {{2, 1, 1, &sieve_.inv2_, false}, {6, 1, 1, &sieve_.inv6_, false},
+                                         {6, 5, 1, &sieve_.inv6_, false}, {1, 0, 3, nullptr, true}};
+
+    begin_ = begin;
+    end_ = std::min(begin + TERM_FACTORS_WINDOW, std::max(last_, begin + 1));
+    uint32_t size = end_ - begin_;
+    std::vector<Hit> hits[2];
+    std::vector<uint32_t> rest(size);
+    for (const Progression& prog: progressions) {
+        std::vector<Hit>& out = hits[prog.q];
+        for (uint32_t i = 0; i < size; i++) {
+            rest[i] = prog.a * static_cast<uint32_t>(begin_ + 1 + i) - prog.b;
+        }
+        uint64_t largest = rest[size - 1];
+        for (size_t j = 0; j < sieve_.primes_.size(); j++) {
+            uint64_t p = sieve_.primes_[j];
+            if (p * p > largest) break;
+            if (prog.inv && (*prog.inv)[j] == 0) continue;
+            uint64_t k = prog.inv ? prog.b * (*prog.inv)[j] % p : 0;
+            for (uint64_t i = (k + p - (begin_ + 1) % p) % p; i < size; i += p) {
+                uint32_t e = 0;
+                while (rest[i] % p == 0) {
+                    rest[i] /= p;
+                    e++;
+                }
+                out.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(p), e * prog.exp});
+            }
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            if (rest[i] > 1) out.push_back({i, rest[i], prog.exp});
+        }
+    }
+
+    // group the factors by term
+    std::vector<uint32_t>* offsets[2] = {&p_offsets_, &q_offsets_};
+    FacList* factors[2] = {&p_factors_, &q_factors_};
+    for (int q = 0; q < 2; q++) {
+        offsets[q]->assign(size + 1, 0);
+        for (const Hit& hit: hits[q]) {
+            (*offsets[q])[hit.i + 1]++;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            (*offsets[q])[i + 1] += (*offsets[q])[i];
+        }
+        std::vector<uint32_t> next(offsets[q]->begin(), offsets[q]->end() - 1);
+        factors[q]->resize(hits[q].size());
+        for (const Hit& hit: hits[q]) {
+            (*factors[q])[next[hit.i]++] = {hit.p, hit.e};
+        }
+    }
+}
+
+void TermFactors::Append(int n1, int n2, FacList& fp, FacList& fq) {
+    for (int k = n1 + 1; k <= n2; k++) {
+        if (k <= begin_ || k > end_) Sieve(k - 1);
+        uint32_t i = k - begin_ - 1;
+        fp.insert(fp.end(), p_factors_.begin() + p_offsets_[i], p_factors_.begin() + p_offsets_[i + 1]);
+        fq.insert(fq.end(), q_factors_.begin() + q_offsets_[i], q_factors_.begin() + q_offsets_[i + 1]);
+    }
+}
+
+void FactorTrial(uint64_t n, uint32_t exp, FacList& fac) {
+    for (uint64_t p = 2; p * p <= n; p++) {
+        uint32_t e = 0;
+        while (n % p == 0) {
+            n /= p;
+            e++;
+        }
+        if (e > 0) fac.emplace_back(p, e * exp);
+    }
+    if (n > 1) fac.emplace_back(n, exp);
+}
+
+void SortFac(FacList& fac) {
+    std::sort(fac.begin(), fac.end());
+    size_t n = 0;
+    for (size_t i = 0; i < fac.size(); i++) {
+        if (n > 0 && fac[n-1].first == fac[i].first) fac[n-1].second += fac[i].second;
+        else fac[n++] = fac[i];
+    }
+    fac.resize(n);
+}
+
+void MergeFac(const FacList& a, const FacList& b, FacList& res) {
+    res.clear();
+    res.reserve(a.size() + b.size());
+    size_t i = 0, j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (j == b.size() || (i < a.size() && a[i].first < b[j].first)) {
+            res.push_back(a[i++]);
+        } else if (i == a.size() || b[j].first < a[i].first) {
+            res.push_back(b[j++]);
+        } else {
+            res.emplace_back(a[i].first, a[i].second + b[j].second);
+            i++;
+            j++;
+        }
+    }
+}
+
+// drop the primes whose exponent went down to 0
+static void CompactFac(FacList& fac) {
+    fac.erase(std::remove_if(fac.begin(), fac.end(), [](const std::pair<uint32_t, uint32_t>& f) {return f.second == 0;}), fac.end());
+}
+
+size_t RemoveCommonFactors(mpz_class& a, FacList& fa, mpz_class& b, FacList& fb) {
+    mpz_class g = 1;
+    // small factors are gathered in one limb before they go to g
+    uint64_t word = 1;
+    bool found = false;
+    size_t i = 0, j = 0;
+    while (i < fa.size() && j < fb.size()) {
+        if (fa[i].first < fb[j].first) {
+            i++;
+        } else if (fb[j].first < fa[i].first) {
+            j++;
+        } else {
+            uint32_t p = fa[i].first, e = std::min(fa[i].second, fb[j].second);
+            fa[i++].second -= e;
+            fb[j++].second -= e;
+            found = true;
+            for (uint32_t k = 0; k < e; k++) {
+                if (word > UINT64_MAX / p) {
+                    mpz_mul_ui(g.get_mpz_t(), g.get_mpz_t(), word);
+                    word = 1;
+                }
+                word *= p;
+            }
+        }
+    }
+    if (!found) return 0;
+
+    mpz_mul_ui(g.get_mpz_t(), g.get_mpz_t(), word);
+    mpz_divexact(a.get_mpz_t(), a.get_mpz_t(), g.get_mpz_t());
+    mpz_divexact(b.get_mpz_t(), b.get_mpz_t(), g.get_mpz_t());
+    CompactFac(fa);
+    CompactFac(fb);
+
+    return mpz_sizeinbase(g.get_mpz_t(), 2) - 1;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <gmpxx.h>
+
+/*
+ * Factored form of P and Q for the common factor removal of the binary splitting.
+ * The terms of P, (2k-1)(6k-1)(6k-5), and of Q, C^3/24 k^3, are all below 6N, so they are factored
+ * by a segmented sieve with the primes up to sqrt(6N). When the left P1 and the right Q2 are merged, their common factors
+ * d are divided out of both, so the merged P, Q and T all are divided by d, which does not change the ratio of pi.
+ */
+// (prime, exponent), by increasing prime
+typedef std::vector<std::pair<uint32_t, uint32_t>> FacList;
+
+// terms factored at once by TermFactors
+const int TERM_FACTORS_WINDOW = 4096;
+
+class FactorSieve {
+    friend class TermFactors;
+
+    uint32_t limit_;
+    // primes up to the square root of the limit, and the inverses of 2 and 6 modulo each of them (0 for 2 and 3)
+    std::vector<uint32_t> primes_, inv2_, inv6_;
+
+public:
+    explicit FactorSieve(uint32_t limit);
+
+    uint32_t Limit() const {return limit_;}
+    size_t Primes() const {return primes_.size();}
+    size_t Bytes() const {return 3 * primes_.size() * sizeof(uint32_t);}
+};
+
+/*
+ * Factors of the terms of a batch, in increasing order of k, as the leaves of the binary splitting go.
+ * The terms are sieved TERM_FACTORS_WINDOW at a time with the primes of the sieve: what is left of a number is 1 or a prime.
+ */
+class TermFactors {
+    const FactorSieve& sieve_;
+    // the window (begin_, end_] is factored, the terms are not beyond last_
+    int begin_, end_, last_;
+    // the factors of term k are [offsets[k - begin_ - 1], offsets[k - begin_]) of factors
+    std::vector<uint32_t> p_offsets_, q_offsets_;
+    FacList p_factors_, q_factors_;
+
+    void Sieve(int begin);
+
+public:
+    // the terms up to last
+    TermFactors(const FactorSieve& sieve, int last);
+
+    // appends the factors of the terms (n1, n2] of P, (2k-1)(6k-1)(6k-5), and of Q without C^3/24, k^3
+    // fac must be sorted with SortFac() afterwards
+    void Append(int n1, int n2, FacList& fp, FacList& fq);
+};
+
+// appends the factors of n^exp to fac by trial division, for constants beyond the sieve
+void FactorTrial(uint64_t n, uint32_t exp, FacList& fac);
+// sort fac by prime and merge the exponents of the same prime
+void SortFac(FacList& fac);
+// res = a * b
+void MergeFac(const FacList& a, const FacList& b, FacList& res);
+// divide a and b by their common factors, which are known from fa and fb, returns the number of bits removed from each
+size_t RemoveCommonFactors(mpz_class& a, FacList& fa, mpz_class& b, FacList& fb);
@@ -0,0 +1,113 @@
+#include <cstdint>
+#include <cstring>
+
+#include "leaf.hpp"
+
+#if GMP_NUMB_BITS == 64 && GMP_NAIL_BITS == 0 && defined(__SIZEOF_INT128__)
+#define LEAF_KERNEL 1
+typedef unsigned __int128 uint128_t;
+#else
+#define LEAF_KERNEL 0
+#endif
+
+// constants of the Chudnovsky series
+static constexpr uint64_t LEAF_A = 13591409;
+static constexpr uint64_t LEAF_B = 545140134;
+static constexpr uint64_t LEAF_C3_24 = 640320ULL * 640320ULL * 640320ULL / 24;
+// largest term whose (A + B k) (2k-1)(6k-1)(6k-5) stays below 2^128
+static constexpr int LEAF_MAX_K = 8000000;
+// every term adds at most 2 limbs, plus the carry of the addition of T
+static constexpr int LEAF_LIMBS = 2 * LEAF_MAX_TERMS + 4;
+
+bool LeafPQTFits(int n1, int n2) {
+    return LEAF_KERNEL && n1 < n2 && n2 - n1 <= LEAF_MAX_TERMS && n2 <= LEAF_MAX_K;
+}
+
+#if LEAF_KERNEL
+// {rp, return} = {up, n} * x, rp must not overlap up
+static mp_size_t MulSmall(mp_limb_t* rp, const mp_limb_t* up, mp_size_t n, uint128_t x) {
+    if (n == 0) return 0;
+    mp_limb_t lo = static_cast<mp_limb_t>(x), hi = static_cast<mp_limb_t>(x >> 64);
+    rp[n] = mpn_mul_1(rp, up, n, lo);
+    rp[n+1] = hi ? mpn_addmul_1(rp + 1, up, n, hi) : 0;
+    n += 2;
+    while (n > 0 && rp[n-1] == 0) n--;
+
+    return n;
+}
+
+// {rp, return} = |{xp, xn} - {yp, yn}|, negative is set if x < y
+static mp_size_t SubAbs(mp_limb_t* rp, const mp_limb_t* xp, mp_size_t xn, const mp_limb_t* yp, mp_size_t yn, bool& negative) {
+    negative = xn < yn || (xn == yn && mpn_cmp(xp, yp, xn) < 0);
+    if (negative) {
+        std::swap(xp, yp);
+        std::swap(xn, yn);
+    }
+    if (yn > 0) mpn_sub(rp, xp, xn, yp, yn);
+    else memcpy(rp, xp, xn * sizeof(mp_limb_t));
+    while (xn > 0 && rp[xn-1] == 0) xn--;
+
+    return xn;
+}
+
+static void SetMpz(mpz_class& z, const mp_limb_t* p, mp_size_t n, bool negative) {
+    mp_limb_t* d = mpz_limbs_write(z.get_mpz_t(), n);
+    memcpy(d, p, n * sizeof(mp_limb_t));
+    mpz_limbs_finish(z.get_mpz_t(), negative ? -n : n);
+}
+#endif
+
+void LeafPQT(int n1, int n2, NativePQT& res) {
+#if LEAF_KERNEL
+    mp_limb_t buf[6][LEAF_LIMBS];
+    mp_limb_t *P = buf[0], *Q = buf[1], *T = buf[2], *P2 = buf[3], *Q2 = buf[4], *T2 = buf[5];
+    mp_limb_t R[LEAF_LIMBS];
+    mp_size_t pn = 0, qn = 0, tn = 0;
+    bool t_negative = false;
+
+    for (uint64_t k = n1 + 1; k <= static_cast<uint64_t>(n2); k++) {
+        uint128_t p = static_cast<uint128_t>((2 * k - 1) * (6 * k - 1)) * (6 * k - 5);
+        uint128_t q = static_cast<uint128_t>(k * k) * k * LEAF_C3_24;
+        uint128_t t = p * (LEAF_A + LEAF_B * k);
+        bool negative = (k & 1) == 1;
+
+        if (k == static_cast<uint64_t>(n1) + 1) {
+            P[0] = static_cast<mp_limb_t>(p), P[1] = static_cast<mp_limb_t>(p >> 64);
+            Q[0] = static_cast<mp_limb_t>(q), Q[1] = static_cast<mp_limb_t>(q >> 64);
+            T[0] = static_cast<mp_limb_t>(t), T[1] = static_cast<mp_limb_t>(t >> 64);
+            pn = P[1] ? 2 : 1;
+            qn = Q[1] ? 2 : 1;
+            tn = T[1] ? 2 : 1;
+            t_negative = negative;
+            continue;
+        }
+
+        // T = T q + P t, with the old P
+        tn = MulSmall(T2, T, tn, q);
+        mp_size_t rn = MulSmall(R, P, pn, t);
+        if (negative == t_negative) {
+            if (tn >= rn) {
+                T2[tn] = mpn_add(T2, T2, tn, R, rn);
+            } else {
+                T2[rn] = mpn_add(T2, R, rn, T2, tn);
+                tn = rn;
+            }
+            tn += T2[tn] != 0;
+        } else {
+            bool flip;
+            tn = SubAbs(T2, T2, tn, R, rn, flip);
+            t_negative = t_negative != flip;
+        }
+        std::swap(T, T2);
+
+        pn = MulSmall(P2, P, pn, p);
+        std::swap(P, P2);
+        qn = MulSmall(Q2, Q, qn, q);
+        std::swap(Q, Q2);
+    }
+
+    SetMpz(res.P, P, pn, false);
+    SetMpz(res.Q, Q, qn, false);
+    SetMpz(res.T, T, tn, t_negative && tn > 0);
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "utils.hpp"
+
+/*
+ * Leaf kernel of the binary splitting: P, Q, T of a small range of terms, without going through mpz for every term.
+ * The terms (2k-1)(6k-1)(6k-5), C^3/24 k^3 and (A + B k) (2k-1)(6k-1)(6k-5) are computed with 128-bit arithmetic,
+ * and accumulated one by one from the left with mpn products by 2 limbs, in limb buffers on the stack:
+ * P = P p_k, Q = Q q_k, T = T q_k + P t_k.
+ */
+// most terms of one leaf
+const int LEAF_MAX_TERMS = 32;
+
+// whether the leaf kernel can compute [n1, n2), i.e. it is small enough and every term fits in 128 bits
+bool LeafPQTFits(int n1, int n2);
+// P, Q, T of the terms (n1, n2]
+void LeafPQT(int n1, int n2, NativePQT& res);
@@ -1,9 +1,11 @@
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 
 #include <signal.h>
 #include "chudnovsky.hpp"
+#include "server.hpp"
 
 using namespace std;
 
@@ -26,12 +28,78 @@ int ParseParameters(unordered_map<string, string>& config, int argc, char** argv
             config["mode"] = "sm";
         } else if (para == "-h") {
             config["help"] = "set";
+        } else if (para == "-f") {
+            config["fixed"] = "set";
+        } else if (para == "-r") {
+            config["newton"] = "set";
+        } else if (para == "-g") {
+            config["factor"] = "set";
+        } else if (para == "-e") {
+            config["truncate"] = "set";
+        } else if (para == "-mc") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a number of primes (1 to 4) of the modular check after -mc" << endl;
+            config["modcheck"] = argv[i];
+        } else if (para == "-trace") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a file for the Chrome trace after -trace" << endl;
+            config["trace"] = argv[i];
+        } else if (para == "-x") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a number of hex digits after -x" << endl;
+            config["hex"] = argv[i];
         } else if (para == "-n") {
             config["nout"] = "set";
         } else if (para == "-v") {
             ++i;
             if (i >= argc) cerr << " [X] Please give a number for version of multithread implementation after -v" << endl;
             config["version"] = argv[i];
+        } else if (para == "-t") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a number of limbs for NTT threshold after -t" << endl;
+            config["ntt"] = argv[i];
+        } else if (para == "-q") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a queue type (boost|lockfree) after -q" << endl;
+            config["queue"] = argv[i];
+        } else if (para == "-o") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a RAM budget (MB) for out-of-core mode after -o" << endl;
+            config["spill"] = argv[i];
+        } else if (para == "-d") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give scratch directories (dir1,dir2,...) after -d" << endl;
+            config["spilldirs"] = argv[i];
+        } else if (para == "-c") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a checkpoint directory after -c" << endl;
+            config["checkpoint"] = argv[i];
+        } else if (para == "-resume") {
+            config["resume"] = "set";
+        } else if (para == "-save") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a file to save the root of the merge tree after -save" << endl;
+            config["save"] = argv[i];
+        } else if (para == "-extend") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a file of a saved root to extend after -extend" << endl;
+            config["extend"] = argv[i];
+        } else if (para == "-k") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a directory of the subtree cache after -k" << endl;
+            config["cache"] = argv[i];
+        } else if (para == "-kb") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a size budget (MB) of the subtree cache after -kb" << endl;
+            config["cachebudget"] = argv[i];
+        } else if (para == "-serve") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a Unix socket to serve the digits on after -serve" << endl;
+            config["serve"] = argv[i];
+        } else if (para == "-a") {
+            ++i;
+            if (i >= argc) cerr << " [X] Please give a cache size (MB) of large blocks for the allocator after -a" << endl;
+            config["alloc"] = argv[i];
         } else if (para == "-w") {
             ++i;
             if (i >= argc) cerr << " [X] Please give a number for digits of PI after -p" << endl;
@@ -42,15 +110,35 @@ int ParseParameters(unordered_map<string, string>& config, int argc, char** argv
         }
     }
 
-    if (config.find("digits") == config.end() || config.find("help") != config.end()) {
-        cerr << "usage: {exe} -p {digits} [-w {workers}] [-v {version}] [(-s|-m|-sm)] [(-n)]" << endl;
+    if ((config.find("digits") == config.end() && config.find("serve") == config.end()) || config.find("help") != config.end()) {
+        cerr << "usage: {exe} -p {digits} [-w {workers}] [-v {version}] [-t {limbs}] [-q {queue}] [-o {MB} [-d {dirs}]] [-c {dir} [-resume]] [-save {file}] [-extend {file}] [-k {dir} [-kb {MB}]] [-a {MB}] [(-s|-m|-sm)] [(-r|-f)] [-g] [-e] [-mc {primes}] [-x {count}] [-trace {file}] [(-n)]" << endl;
+        cerr << "       {exe} -serve {socket} [-w {workers}] [-v {version}] [-q {queue}] [-a {MB}] [(-r|-f)] [-g]" << endl;
         cerr << endl;
         cerr << "   -p: specify the precision of PI." << endl;
         cerr << "   -w: specify the number of worker." << endl;
-        cerr << "   -v: specify the verion of multithread implementation. Currently 1, 2, 3 is available, and default is 3." << endl;
+        cerr << "   -v: specify the verion of multithread implementation. Currently 1, 2, 3, 4 is available, and default is 3." << endl;
+        cerr << "   -t: specify the operand size (limbs) from which multiplication uses multithreaded NTT, 0 to disable. Default is 524288." << endl;
+        cerr << "   -q: specify the queue of ReqPack/RespPack traffic, boost or lockfree. Default is boost, unless built with -DLOCKFREE_QUEUE." << endl;
+        cerr << "   -o: out-of-core mode, PQT held between merges beyond this RAM budget (MB) are spilled to scratch files." << endl;
+        cerr << "   -d: specify the comma separated directories (e.g. on several disks) of the scratch files for -o. Default is ." << endl;
+        cerr << "   -c: checkpoint the finished subtrees of multi thread mode into this directory." << endl;
+        cerr << "   -resume: reload the finished subtrees of the checkpoint directory and compute only the missing ones." << endl;
+        cerr << "   -save: save the root of the merge tree of multi thread mode to this file, for a later run to extend." << endl;
+        cerr << "   -extend: reuse the root saved by a previous run, only the terms beyond it are computed and merged with it in multi thread mode." << endl;
+        cerr << "   -k: look up the batches of multi thread mode in the persistent subtree cache of this directory." << endl;
+        cerr << "   -kb: also store the new batches in the cache of -k, evicting the least recently used beyond this size (MB)." << endl;
+        cerr << "   -serve: serve the decimals of PI on this Unix socket, a line \"{begin} {end}\" is answered with the decimals [begin, end)." << endl;
+        cerr << "   -a: use the thread-local pool allocator for GMP, keeping up to this size (MB) of freed large blocks for reuse." << endl;
         cerr << "   -s: using single thread mode to calculate PI." << endl;
         cerr << "   -m: using multi thread mode to calculate PI. Default." << endl;
         cerr << "   -sm: using both single thread and multi thread mode to calculate PI." << endl;
+        cerr << "   -r: use Newton reciprocal with products spread on workers for the final division of multi thread mode." << endl;
+        cerr << "   -f: use fixed point final stage with fused inverse square root instead of mpf in multi thread mode." << endl;
+        cerr << "   -g: cancel the common factors of P and Q in the binary splitting of the batches, with a sieve of the factors of the terms." << endl;
+        cerr << "   -e: truncate the operands of the top merges of multi thread mode to the precision of PI plus guard bits, with a bound of the error." << endl;
+        cerr << "   -mc: check every product of the merges of multi thread mode modulo word-size primes (1 to 4), multiplying again a product which fails, and the root at the end." << endl;
+        cerr << "   -x: write the last hex digits (count) of PI of multi thread mode to pi_hex.txt, even with -n, for the BBP check of verifier -x." << endl;
+        cerr << "   -trace: record the tasks of every worker and the stages of master, and write them to this file as Chrome trace JSON." << endl;
         cerr << "   -n: do not output." << endl;
         cerr << "   -h: print this message." << endl;
         return -1;
@@ -66,8 +154,46 @@ int main(int argc, char** argv) {
     }
 
     try {
+        // before anything is allocated by GMP
+        if (config.find("alloc") != config.end()) InstallGmpAllocator(stol(config["alloc"]) << 20);
+
+        // before the workers start
+        if (config.find("trace") != config.end()) TraceStart();
+
         // instantiation
-        Chudnovsky calc(stoi(config["version"]), stoi(config["digits"]), stoi(config["worker"]));
+        QueueKind queue_kind = DEFAULT_QUEUE_KIND;
+        if (config["queue"] == "lockfree") queue_kind = QUEUE_LOCKFREE;
+        else if (config["queue"] == "boost") queue_kind = QUEUE_BOOST;
+        if (config.find("serve") != config.end()) {
+            PiEngine engine(stoi(config["worker"]), queue_kind);
+            PiOptions options;
+            options.version = stoi(config["version"]);
+            options.newton_division = config.find("newton") != config.end();
+            options.fixed_point = config.find("fixed") != config.end();
+            options.factor_removal = config.find("factor") != config.end();
+            PiServer server(engine, config["serve"], options);
+            return server.Run() ? 0 : -1;
+        }
+        Chudnovsky calc(stoi(config["version"]), stoi(config["digits"]), stoi(config["worker"]), queue_kind);
+        if (config.find("ntt") != config.end()) calc.SetNTTThreshold(stol(config["ntt"]));
+        calc.SetNewtonDivision(config.find("newton") != config.end());
+        calc.SetFixedPoint(config.find("fixed") != config.end());
+        calc.SetFactorRemoval(config.find("factor") != config.end());
+        calc.SetTruncate(config.find("truncate") != config.end());
+        if (config.find("hex") != config.end()) calc.SetHexTail(stol(config["hex"]));
+        if (config.find("modcheck") != config.end()) calc.SetModCheck(stoi(config["modcheck"]));
+        if (config.find("spill") != config.end()) {
+            vector<string> dirs;
+            stringstream ss(config["spilldirs"]);
+            for (string dir; getline(ss, dir, ',');) {
+                if (!dir.empty()) dirs.push_back(dir);
+            }
+            calc.SetSpill(stol(config["spill"]), dirs);
+        }
+        if (config.find("checkpoint") != config.end()) calc.SetCheckpoint(config["checkpoint"], config.find("resume") != config.end());
+        if (config.find("save") != config.end()) calc.SetSaveRoot(config["save"]);
+        if (config.find("extend") != config.end()) calc.SetExtendRoot(config["extend"]);
+        if (config.find("cache") != config.end()) calc.SetCache(config["cache"], config.find("cachebudget") != config.end() ? stol(config["cachebudget"]) : 0);
 
         // single thread
         if (config["mode"].find("s") != string::npos) {
@@ -80,6 +206,9 @@ int main(int argc, char** argv) {
             cerr << " [*] Multi Thread Mode: " << endl;
             calc.StartConcurrent(config.find("nout") != config.end());
         }
+
+        // the workers are idle
+        if (config.find("trace") != config.end() && !TraceDump(config["trace"])) cerr << " [X] Cannot write the trace to " << config["trace"] << endl;
     } catch (...) {
         cout << " [X] ERROR!" << endl;
         return -1;
@@ -0,0 +1,52 @@
+#include <algorithm>
+
+#include "modcheck.hpp"
+
+// the largest primes below 2^64: 2^64 - 59, 2^64 - 83, 2^64 - 95, 2^64 - 179
+static const uint64_t MODCHECK_PRIMES[MODCHECK_MAX_PRIMES] = {
+    18446744073709551557ULL, 18446744073709551533ULL, 18446744073709551521ULL, 18446744073709551437ULL
+};
+
+ModCheck::ModCheck(int count): count_(std::min(std::max(count, 1), MODCHECK_MAX_PRIMES)), checked_(0), failed_(0) {}
+
+Residues ModCheck::Of(const mpz_class& x) const {
+    Residues res = {};
+    for (int i = 0; i < count_; i++) {
+        // the floor division keeps a negative T in [0, p)
+        res[i] = mpz_fdiv_ui(x.get_mpz_t(), MODCHECK_PRIMES[i]);
+    }
+
+    return res;
+}
+
+void ModCheck::Of(const PQT& pqt, std::array<Residues, 3>& mod) const {
+    mod[0] = Of(*pqt.P);
+    mod[1] = Of(*pqt.Q);
+    mod[2] = Of(*pqt.T);
+}
+
+Residues ModCheck::Mul(const Residues& a, const Residues& b) const {
+    Residues res = {};
+    for (int i = 0; i < count_; i++) {
+        res[i] = static_cast<uint64_t>(static_cast<unsigned __int128>(a[i]) * b[i] % MODCHECK_PRIMES[i]);
+    }
+
+    return res;
+}
+
+Residues ModCheck::Add(const Residues& a, const Residues& b) const {
+    Residues res = {};
+    for (int i = 0; i < count_; i++) {
+        res[i] = static_cast<uint64_t>((static_cast<unsigned __int128>(a[i]) + b[i]) % MODCHECK_PRIMES[i]);
+    }
+
+    return res;
+}
+
+bool ModCheck::Check(const Residues& expected, const Residues& res) {
+    checked_++;
+    if (expected == res) return true;
+    failed_++;
+
+    return false;
+}
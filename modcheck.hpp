@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+
+#include "utils.hpp"
+
+/*
+ * Modular self-check of the products of the merges, against silent hardware faults.
+ * Every PQT of the merge tree carries P, Q and T modulo a few word-size primes. A product of a merge is checked by
+ * (a mod p) (b mod p) = (a b) mod p, with the residues of its operands carried from their own merge, so that only
+ * the product is reduced, and its residues are carried up in turn, T1 + T2 by adding them.
+ * A product which fails the check is multiplied again. The root P, Q and T are reduced at the end and compared
+ * with the residues carried up the tree, which also covers the additions of master and the spilled subtrees.
+ */
+// multiplications of a product which keeps failing the check
+const int MODCHECK_RETRIES = 3;
+
+class ModCheck {
+    int count_;
+    std::atomic<size_t> checked_, failed_;
+
+public:
+    // with the count largest primes below 2^64, up to MODCHECK_MAX_PRIMES
+    explicit ModCheck(int count);
+
+    Residues Of(const mpz_class& x) const;
+    void Of(const PQT& pqt, std::array<Residues, 3>& mod) const;
+    Residues Mul(const Residues& a, const Residues& b) const;
+    Residues Add(const Residues& a, const Residues& b) const;
+    // counts a check of a product, false if it fails
+    bool Check(const Residues& expected, const Residues& res);
+    size_t Checked() const {return checked_;}
+    size_t Failed() const {return failed_;}
+    int Count() const {return count_;}
+};
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/thread/sync_queue.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MPMC_PAUSE() _mm_pause()
+#else
+#define MPMC_PAUSE() std::this_thread::yield()
+#endif
+
+/*
+ * Bounded lock-free multi-producer multi-consumer ring buffer (D. Vyukov's algorithm).
+ * Every cell carries a sequence number telling whether it is ready to be written or read,
+ * so producers and consumers only contend on one CAS of their own position.
+ * Items are moved in and out, never copied.
+ * Blocking push() / pull() spin first, with a spin budget that adapts to how often spinning succeeds,
+ * then park on a condition variable.
+ */
+template<typename T>
+class MPMCQueue {
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    static const int MIN_SPIN = 16;
+    static const int MAX_SPIN = 1 << 12;
+
+    std::vector<Cell> cells_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<size_t> dequeue_pos_{0};
+    alignas(64) std::atomic<int> spin_{MAX_SPIN >> 4};
+    std::atomic<int> push_waiters_{0}, pull_waiters_{0};
+    std::mutex park_mtx_;
+    std::condition_variable not_empty_, not_full_;
+
+    void Wake(std::atomic<int>& waiters, std::condition_variable& cv) {
+        if (waiters.load() == 0) return;
+        std::lock_guard<std::mutex> lock(park_mtx_);
+        cv.notify_one();
+    }
+
+    // spin, then park until ready() holds, try() is retried in between
+    template<typename Try, typename Ready>
+    void Wait(Try try_once, Ready ready, std::atomic<int>& waiters, std::condition_variable& cv) {
+        while (true) {
+            int spin = spin_.load(std::memory_order_relaxed);
+            for (int i = 0; i < spin; i++) {
+                if (try_once()) {
+                    if (spin < MAX_SPIN) spin_.store(spin << 1, std::memory_order_relaxed);
+                    return;
+                }
+                if (i < (spin >> 1)) MPMC_PAUSE();
+                else std::this_thread::yield();
+            }
+            if (spin > MIN_SPIN) spin_.store(spin >> 1, std::memory_order_relaxed);
+
+            std::unique_lock<std::mutex> lock(park_mtx_);
+            waiters.fetch_add(1);
+            cv.wait(lock, ready);
+            waiters.fetch_sub(1);
+            lock.unlock();
+            if (try_once()) return;
+        }
+    }
+
+public:
+    explicit MPMCQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells_ = std::vector<Cell>(size);
+        mask_ = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    // item is only moved from on success
+    bool TryPush(T& item) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        Wake(pull_waiters_, not_empty_);
+        return true;
+    }
+
+    bool TryPull(T& item) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->data);
+        // leave a moved-from T behind, so that the cell does not keep any resource alive
+        cell->data = T();
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        Wake(push_waiters_, not_full_);
+        return true;
+    }
+
+    void push(T&& item) {
+        if (TryPush(item)) return;
+        Wait([&] {return TryPush(item);},
+             [this] {return enqueue_pos_.load() - dequeue_pos_.load() <= mask_;},
+             push_waiters_, not_full_);
+    }
+
+    void push(const T& item) {
+        T copy(item);
+        push(std::move(copy));
+    }
+
+    void pull(T& item) {
+        if (TryPull(item)) return;
+        Wait([&] {return TryPull(item);},
+             [this] {return enqueue_pos_.load() != dequeue_pos_.load();},
+             pull_waiters_, not_empty_);
+    }
+};
+
+enum QueueKind {QUEUE_BOOST, QUEUE_LOCKFREE};
+
+// build with -DLOCKFREE_QUEUE to make the lock-free queue the default
+#ifdef LOCKFREE_QUEUE
+const QueueKind DEFAULT_QUEUE_KIND = QUEUE_LOCKFREE;
+#else
+const QueueKind DEFAULT_QUEUE_KIND = QUEUE_BOOST;
+#endif
+
+/*
+ * Queue for ReqPack / RespPack traffic, backed by either boost::sync_queue or MPMCQueue, chosen at construction.
+ */
+template<typename T>
+class PackQueue {
+    QueueKind kind_;
+    boost::sync_queue<T> boost_q_;
+    MPMCQueue<T> lockfree_q_;
+public:
+    explicit PackQueue(QueueKind kind, size_t capacity = 1 << 12): kind_(kind), lockfree_q_(kind == QUEUE_LOCKFREE ? capacity : 2) {}
+
+    QueueKind GetKind() const {return kind_;}
+
+    void push(T&& item) {
+        if (kind_ == QUEUE_LOCKFREE) lockfree_q_.push(std::move(item));
+        else boost_q_.push(std::move(item));
+    }
+
+    void push(const T& item) {
+        if (kind_ == QUEUE_LOCKFREE) lockfree_q_.push(item);
+        else boost_q_.push(item);
+    }
+
+    void pull(T& item) {
+        if (kind_ == QUEUE_LOCKFREE) lockfree_q_.pull(item);
+        else boost_q_.pull(item);
+    }
+};
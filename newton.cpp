@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "newton.hpp"
+
+mpz_class TopBits(const mpz_class& f, long e, long m) {
+    if (e >= m) return f >> (e - m);
+    return f << (m - e);
+}
+
+std::vector<long> NewtonSchedule(long m_final, long m_seed) {
+    std::vector<long> ms;
+    long m = m_final;
+    // each step roughly doubles the precision, 32 bits are kept as margin for the error of the previous step
+    while (m > std::max(m_seed, 128L)) {
+        ms.push_back(m);
+        m = m / 2 + 32;
+    }
+    ms.push_back(m);
+    std::reverse(ms.begin(), ms.end());
+
+    return ms;
+}
+
+void ReciprocalSeed(mpz_class& x, const mpz_class& f, long e, long m) {
+    mpz_class one = 1;
+    x = (one << (2 * m)) / TopBits(f, e, m);
+}
+
+/*
+ * x_new = x0 + x0 * (1 - F_m * x0), with x0 = x * 2^(m-m_old), in fixed point:
+ *   err = 2^(2m) - F_m * x0
+ *   x_new = x0 + x * err / 2^(m+m_old)
+ * F_m * x is a (m x m_old)-bit product, and err has only about m-m_old significant bits.
+ */
+void ReciprocalStep(mpz_class& x, const mpz_class& f, long e, long m_old, long m, const MulFunc& mul) {
+    mpz_class fm = TopBits(f, e, m), t, err = 1, u;
+
+    mul(t, fm, x);
+    t <<= (m - m_old);
+    err <<= (2 * m);
+    err -= t;
+
+    mul(u, x, err);
+    x <<= (m - m_old);
+    x += u >> (m + m_old);
+}
+
+void RecipSqrtSeed(mpz_class& x, const mpz_class& f, long e, long m, unsigned long k) {
+    mpz_class s = k;
+    s <<= (4 * m);
+    x = sqrt(s) / TopBits(f, e, m);
+}
+
+/*
+ * w = sqrt(k) / F_m is the inverse square root of F_m^2 / k, so
+ *   w_new = w0 + w0 * (1 - (F_m * w0)^2 / k) / 2
+ * in fixed point, with x0 = x * 2^(m-m_old):
+ *   u = F_m * x0 / 2^m ≈ 2^m * sqrt(k)
+ *   err = k * 2^(2m) - u^2
+ *   x_new = x0 + x * err / (2k * 2^(m+m_old))
+ * Only u is squared, at m bits, instead of F_m * x0 at 2m bits.
+ */
+void RecipSqrtStep(mpz_class& x, const mpz_class& f, long e, long m_old, long m, unsigned long k, const MulFunc& mul) {
+    mpz_class fm = TopBits(f, e, m), u, err = k, t;
+
+    mul(u, fm, x);
+    u >>= m_old;
+    mul(t, u, u);
+    err <<= (2 * m);
+    err -= t;
+
+    mul(t, x, err);
+    t >>= (m + m_old + 1);
+    mpz_fdiv_q_ui(t.get_mpz_t(), t.get_mpz_t(), k);
+    x <<= (m - m_old);
+    x += t;
+}
+
+void KaratsubaSplit(const mpz_class& a, const mpz_class& b, int level, size_t min_limbs,
+                    std::vector<std::pair<mpz_class, mpz_class>>& leaves, std::vector<mp_bitcnt_t>& splits) {
+    size_t a_size = mpz_size(a.get_mpz_t()), b_size = mpz_size(b.get_mpz_t());
+    if (level <= 0 || std::min(a_size, b_size) < std::max(min_limbs, static_cast<size_t>(2))) {
+        splits.push_back(0);
+        leaves.emplace_back(abs(a), abs(b));
+        return;
+    }
+
+    mp_bitcnt_t h = (std::max(a_size, b_size) / 2) * GMP_NUMB_BITS;
+    mpz_class aa = abs(a), bb = abs(b), a0, b0;
+    mpz_tdiv_r_2exp(a0.get_mpz_t(), aa.get_mpz_t(), h);
+    mpz_tdiv_r_2exp(b0.get_mpz_t(), bb.get_mpz_t(), h);
+    aa >>= h;
+    bb >>= h;
+
+    splits.push_back(h);
+    KaratsubaSplit(a0, b0, level - 1, min_limbs, leaves, splits);
+    KaratsubaSplit(aa, bb, level - 1, min_limbs, leaves, splits);
+    aa += a0;
+    bb += b0;
+    KaratsubaSplit(aa, bb, level - 1, min_limbs, leaves, splits);
+}
+
+mpz_class KaratsubaMerge(std::vector<mpz_class>& products, const std::vector<mp_bitcnt_t>& splits, size_t& leaf, size_t& node) {
+    mp_bitcnt_t h = splits[node++];
+    if (h == 0) return std::move(products[leaf++]);
+
+    mpz_class z0 = KaratsubaMerge(products, splits, leaf, node);
+    mpz_class z2 = KaratsubaMerge(products, splits, leaf, node);
+    mpz_class z1 = KaratsubaMerge(products, splits, leaf, node);
+    z1 -= z0;
+    z1 -= z2;
+    z2 <<= 2 * h;
+    z1 <<= h;
+    z2 += z1;
+    z2 += z0;
+
+    return z2;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <gmpxx.h>
+
+/*
+ * Fixed point Newton iterations on mpz, the precision doubles at each step.
+ * A big number f is seen through its top m bits with a fixed exponent e: F_m = f / 2^(e-m), so f ≈ F_m * 2^(e-m).
+ * Keeping e fixed lets an approximation of f (e.g. without the lowest bits) be used for the low precision steps.
+ */
+using MulFunc = std::function<void(mpz_class& res, const mpz_class& a, const mpz_class& b)>;
+
+// F_m = floor(f / 2^(e-m))
+mpz_class TopBits(const mpz_class& f, long e, long m);
+// precisions of the Newton steps, increasing, from about m_seed up to m_final
+std::vector<long> NewtonSchedule(long m_final, long m_seed);
+
+// x = 2^(2m) / F_m, exactly, for a small m
+void ReciprocalSeed(mpz_class& x, const mpz_class& f, long e, long m);
+// x ≈ 2^(2m_old) / F_m_old  ->  x ≈ 2^(2m) / F_m
+void ReciprocalStep(mpz_class& x, const mpz_class& f, long e, long m_old, long m, const MulFunc& mul);
+
+// x = 2^(2m) * sqrt(k) / F_m, for a small m
+void RecipSqrtSeed(mpz_class& x, const mpz_class& f, long e, long m, unsigned long k);
+// fused Newton step for the inverse square root of F_m^2 / k:
+// x ≈ 2^(2m_old) * sqrt(k) / F_m_old  ->  x ≈ 2^(2m) * sqrt(k) / F_m
+void RecipSqrtStep(mpz_class& x, const mpz_class& f, long e, long m_old, long m, unsigned long k, const MulFunc& mul);
+
+/*
+ * Karatsuba split of |a| * |b| into 3^level independent products, for spreading a huge product on workers.
+ * KaratsubaSplit() appends the leaf operands in pre-order, and the split point of every node into splits (0 for a leaf).
+ * KaratsubaMerge() consumes the leaf products in the same order and returns |a| * |b|.
+ */
+void KaratsubaSplit(const mpz_class& a, const mpz_class& b, int level, size_t min_limbs,
+                    std::vector<std::pair<mpz_class, mpz_class>>& leaves, std::vector<mp_bitcnt_t>& splits);
+mpz_class KaratsubaMerge(std::vector<mpz_class>& products, const std::vector<mp_bitcnt_t>& splits, size_t& leaf, size_t& node);
@@ -0,0 +1,338 @@
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "ntt.hpp"
+
+using u32 = uint32_t;
+using u64 = uint64_t;
+using u128 = unsigned __int128;
+
+// 3 primes below 2^31 with large power of 2 in p-1, product is about 2^90.4
+// which is enough for 2^26 coefficients of 32 bits: 2^26 * 2^32 * 2^32 < 2^90.4
+static const u32 NTT_PRIMES[3] = {2013265921u /* 15*2^27+1 */, 1811939329u /* 27*2^26+1 */, 469762049u /* 7*2^26+1 */};
+static const int NTT_MAX_LOG = 26;
+// below this length, a transform is done iteratively since it fits in cache
+static const size_t NTT_SERIAL_LEN = 1 << 12;
+// below this length, it is not worth to spawn threads
+static const size_t NTT_PARALLEL_LEN = 1 << 15;
+
+/*
+ * Montgomery arithmetic with R = 2^32, every value is kept in [0, p)
+ */
+struct NTTPrime {
+    u32 p, pinv, r2, g;
+
+    explicit NTTPrime(u32 prime): p(prime) {
+        // p^-1 mod 2^32 by Newton iteration, then negate
+        u32 inv = p;
+        for (int i = 0; i < 5; i++) inv *= 2 - p * inv;
+        pinv = -inv;
+        r2 = static_cast<u32>((static_cast<u128>(1) << 64) % p);
+
+        // find a primitive root by checking all prime factors of p-1
+        std::vector<u32> factors;
+        u32 m = p - 1;
+        for (u32 f = 2; f * f <= m; f++) {
+            if (m % f) continue;
+            factors.push_back(f);
+            while (m % f == 0) m /= f;
+        }
+        if (m > 1) factors.push_back(m);
+        for (g = 2; ; g++) {
+            bool ok = true;
+            for (u32 f: factors) {
+                if (Pow(g, (p - 1) / f) == 1) {
+                    ok = false;
+                    break;
+                }
+            }
+            if (ok) break;
+        }
+    }
+
+    inline u32 Reduce(u64 t) const {
+        u32 m = static_cast<u32>(t) * pinv;
+        u32 r = (t + static_cast<u64>(m) * p) >> 32;
+        return r >= p ? r - p : r;
+    }
+    inline u32 Mul(u32 a, u32 b) const {return Reduce(static_cast<u64>(a) * b);}
+    inline u32 ToMont(u32 a) const {return Mul(a, r2);}
+
+    // plain (non montgomery) modular power
+    u32 Pow(u64 b, u64 e) const {
+        u64 r = 1;
+        b %= p;
+        while (e) {
+            if (e & 1) r = r * b % p;
+            b = b * b % p;
+            e >>= 1;
+        }
+        return static_cast<u32>(r);
+    }
+    u32 Inv(u32 a) const {return Pow(a, p - 2);}
+};
+
+static const NTTPrime& GetPrime(int k) {
+    static const NTTPrime primes[3] = {NTTPrime(NTT_PRIMES[0]), NTTPrime(NTT_PRIMES[1]), NTTPrime(NTT_PRIMES[2])};
+    return primes[k];
+}
+
+/*
+ * Split [0, n) into num_threads chunks and run f(begin, end) on each of them
+ */
+template<typename F>
+static void ParallelFor(int num_threads, size_t n, F f) {
+    if (num_threads <= 1 || n < NTT_PARALLEL_LEN) {
+        f(0, n);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    size_t chunk = (n + num_threads - 1) / num_threads;
+    for (int t = 1; t < num_threads; t++) {
+        size_t begin = std::min(n, chunk * t), end = std::min(n, begin + chunk);
+        if (begin < end) threads.emplace_back(f, begin, end);
+    }
+    f(0, std::min(n, chunk));
+
+    for (auto& thread: threads) {
+        thread.join();
+    }
+}
+
+/*
+ * Butterflies work on 2 contiguous arrays without branches on the data path,
+ * so that the compiler can vectorize them.
+ * tw[len + j] = w_{2len}^j in montgomery form, for every power of 2 len < n.
+ */
+static inline void DifButterfly(u32* a, u32* b, const u32* w, size_t count, const NTTPrime& m) {
+    const u32 p = m.p;
+    for (size_t j = 0; j < count; j++) {
+        u32 u = a[j], v = b[j];
+        u32 s = u + v;
+        a[j] = s >= p ? s - p : s;
+        b[j] = m.Reduce(static_cast<u64>(u + p - v) * w[j]);
+    }
+}
+
+static inline void DitButterfly(u32* a, u32* b, const u32* w, size_t count, const NTTPrime& m) {
+    const u32 p = m.p;
+    for (size_t j = 0; j < count; j++) {
+        u32 u = a[j], v = m.Reduce(static_cast<u64>(b[j]) * w[j]);
+        u32 s = u + v, d = u + p - v;
+        a[j] = s >= p ? s - p : s;
+        b[j] = d >= p ? d - p : d;
+    }
+}
+
+/*
+ * Forward transform, decimation in frequency: natural order in, bit reversed order out.
+ * The first stage is shared by threads, then each half is transformed independently.
+ */
+static void Dif(u32* a, size_t n, const u32* tw, const NTTPrime& m, int num_threads) {
+    if (n <= NTT_SERIAL_LEN) {
+        for (size_t len = n >> 1; len >= 1; len >>= 1) {
+            for (size_t s = 0; s < n; s += len << 1) {
+                DifButterfly(a + s, a + s + len, tw + len, len, m);
+            }
+        }
+        return;
+    }
+
+    size_t half = n >> 1;
+    ParallelFor(num_threads, half, [&](size_t begin, size_t end) {
+        DifButterfly(a + begin, a + half + begin, tw + half + begin, end - begin, m);
+    });
+
+    if (num_threads <= 1 || n < NTT_PARALLEL_LEN) {
+        Dif(a, half, tw, m, 1);
+        Dif(a + half, half, tw, m, 1);
+        return;
+    }
+    std::thread other(Dif, a + half, half, tw, std::cref(m), num_threads - num_threads / 2);
+    Dif(a, half, tw, m, num_threads / 2);
+    other.join();
+}
+
+/*
+ * Inverse transform without scaling, decimation in time: bit reversed order in, natural order out.
+ */
+static void Dit(u32* a, size_t n, const u32* tw, const NTTPrime& m, int num_threads) {
+    if (n <= NTT_SERIAL_LEN) {
+        for (size_t len = 1; len < n; len <<= 1) {
+            for (size_t s = 0; s < n; s += len << 1) {
+                DitButterfly(a + s, a + s + len, tw + len, len, m);
+            }
+        }
+        return;
+    }
+
+    size_t half = n >> 1;
+    if (num_threads <= 1 || n < NTT_PARALLEL_LEN) {
+        Dit(a, half, tw, m, 1);
+        Dit(a + half, half, tw, m, 1);
+    } else {
+        std::thread other(Dit, a + half, half, tw, std::cref(m), num_threads - num_threads / 2);
+        Dit(a, half, tw, m, num_threads / 2);
+        other.join();
+    }
+
+    ParallelFor(num_threads, half, [&](size_t begin, size_t end) {
+        DitButterfly(a + begin, a + half + begin, tw + half + begin, end - begin, m);
+    });
+}
+
+/*
+ * Twiddle table of length n, w is a primitive n-th root of unity in plain form.
+ * Only the top level is computed by multiplication, the lower levels are decimated from it.
+ */
+static void BuildTwiddles(std::vector<u32>& tw, size_t n, u32 w, const NTTPrime& m) {
+    tw.assign(n, 0);
+    if (n < 2) return;
+
+    size_t half = n >> 1;
+    u32 wm = m.ToMont(w);
+    tw[half] = m.ToMont(1);
+    for (size_t j = 1; j < half; j++) {
+        tw[half + j] = m.Mul(tw[half + j - 1], wm);
+    }
+    for (size_t len = half >> 1; len >= 1; len >>= 1) {
+        for (size_t j = 0; j < len; j++) {
+            tw[len + j] = tw[(len << 1) + (j << 1)];
+        }
+    }
+}
+
+/*
+ * Load the 32-bit pieces of limbs into a, reduced modulo p, and zero pad up to n
+ */
+static void LoadPieces(u32* a, size_t n, const mp_limb_t* limbs, size_t limbs_size, const NTTPrime& m, int num_threads) {
+    const u32 p = m.p;
+    ParallelFor(num_threads, n, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            u32 x = (i >> 1) < limbs_size ? static_cast<u32>(limbs[i >> 1] >> ((i & 1) << 5)) : 0;
+            a[i] = x % p;
+        }
+    });
+}
+
+/*
+ * Convolution of a and b modulo the k-th prime, the result is left in fa
+ */
+static void Convolve(std::vector<u32>& fa, const mpz_class& a, const mpz_class& b, size_t n, int k, int num_threads) {
+    const NTTPrime& m = GetPrime(k);
+    bool square = a.get_mpz_t() == b.get_mpz_t() || a == b;
+    std::vector<u32> tw, fb;
+
+    BuildTwiddles(tw, n, m.Pow(m.g, (m.p - 1) / n), m);
+
+    fa.resize(n);
+    LoadPieces(fa.data(), n, mpz_limbs_read(a.get_mpz_t()), mpz_size(a.get_mpz_t()), m, num_threads);
+    Dif(fa.data(), n, tw.data(), m, num_threads);
+    if (!square) {
+        fb.resize(n);
+        LoadPieces(fb.data(), n, mpz_limbs_read(b.get_mpz_t()), mpz_size(b.get_mpz_t()), m, num_threads);
+        Dif(fb.data(), n, tw.data(), m, num_threads);
+    }
+
+    // pointwise product, fold in the scaling R^2/n, which cancels the 2 montgomery reductions and 1/n of the inverse
+    const u32 scale = static_cast<u32>(static_cast<u64>(m.r2) * m.Inv(static_cast<u32>(n % m.p)) % m.p);
+    const u32* pb = square ? fa.data() : fb.data();
+    u32* pa = fa.data();
+    ParallelFor(num_threads, n, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            pa[i] = m.Mul(m.Mul(pa[i], pb[i]), scale);
+        }
+    });
+    fb = std::vector<u32>();
+
+    // the inverse twiddles are the forward ones of w^-1
+    BuildTwiddles(tw, n, m.Inv(m.Pow(m.g, (m.p - 1) / n)), m);
+    Dit(fa.data(), n, tw.data(), m, num_threads);
+}
+
+size_t NTTMaxLimbs() {
+    // 2 pieces per limb
+    return static_cast<size_t>(1) << (NTT_MAX_LOG - 1);
+}
+
+void NTTMul(mpz_class& res, const mpz_class& a, const mpz_class& b, int num_threads) {
+    size_t a_size = mpz_size(a.get_mpz_t()), b_size = mpz_size(b.get_mpz_t());
+    size_t res_size = a_size + b_size;
+    if (GMP_LIMB_BITS != 64 || a_size == 0 || b_size == 0 || res_size > NTTMaxLimbs()) {
+        res = a * b;
+        return;
+    }
+
+    size_t n = 1;
+    while (n < 2 * res_size) n <<= 1;
+    num_threads = std::max(num_threads, 1);
+
+    std::vector<u32> r[3];
+    for (int k = 0; k < 3; k++) {
+        Convolve(r[k], a, b, n, k, num_threads);
+    }
+
+    // CRT by Garner's algorithm, the modular products are done in montgomery form with constants premultiplied by R
+    const NTTPrime &m0 = GetPrime(0), &m1 = GetPrime(1), &m2 = GetPrime(2);
+    const u64 p0 = m0.p, p1 = m1.p;
+    const u32 p0_inv_p1 = m1.ToMont(m1.Inv(static_cast<u32>(p0 % p1)));
+    const u32 p0_mod_p2 = m2.ToMont(static_cast<u32>(p0 % m2.p));
+    const u32 p01_inv_p2 = m2.ToMont(m2.Inv(static_cast<u32>(p0 * p1 % m2.p)));
+    const u32 one_p2 = m2.ToMont(1);
+    const u128 p01 = static_cast<u128>(p0) * p1;
+
+    // straight into res, e.g. a slot reserved for the product, unless it is an operand
+    mpz_class tmp;
+    mpz_class& out = (&res == &a || &res == &b) ? tmp : res;
+    mp_limb_t* rp = mpz_limbs_write(out.get_mpz_t(), res_size);
+
+    // each thread owns a range of limbs and leaves the carry out of its range for the fixup
+    int chunks = res_size < NTT_PARALLEL_LEN ? 1 : num_threads;
+    size_t chunk = (res_size + chunks - 1) / chunks;
+    std::vector<u128> carries(chunks, 0);
+    auto crt = [&](int c) {
+        u128 carry = 0;
+        for (size_t l = std::min(res_size, c * chunk); l < std::min(res_size, (c + 1) * chunk); l++) {
+            mp_limb_t limb = 0;
+            for (size_t h = 0; h < 2; h++) {
+                size_t i = (l << 1) + h;
+                u32 r0 = r[0][i], r1 = r[1][i], r2 = r[2][i];
+                // r0 < p0 < 2p1
+                u32 r0_p1 = r0 >= p1 ? r0 - p1 : r0;
+                u32 x1 = m1.Mul(r1 + m1.p - r0_p1, p0_inv_p1);
+                // x1 < 2^31, r0 < 2^31, so Reduce() of them times montgomery constants stays valid
+                u32 y = m2.Mul(r0, one_p2) + m2.Mul(x1, p0_mod_p2);
+                y = y >= m2.p ? y - m2.p : y;
+                u32 x2 = m2.Mul(r2 + m2.p - y, p01_inv_p2);
+                carry += r0 + static_cast<u128>(x1) * p0 + static_cast<u128>(x2) * p01;
+                limb |= static_cast<mp_limb_t>(static_cast<u32>(carry)) << (h << 5);
+                carry >>= 32;
+            }
+            rp[l] = limb;
+        }
+        carries[c] = carry;
+    };
+    std::vector<std::thread> threads;
+    for (int c = 1; c < chunks; c++) {
+        threads.emplace_back(crt, c);
+    }
+    crt(0);
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    for (int c = 0; c + 1 < chunks; c++) {
+        size_t l = std::min(res_size, (c + 1) * chunk);
+        if (l >= res_size) break;
+        mp_limb_t cy[2] = {static_cast<mp_limb_t>(carries[c]), static_cast<mp_limb_t>(carries[c] >> 64)};
+        if (res_size - l >= 2) mpn_add(rp + l, rp + l, res_size - l, cy, 2);
+        else mpn_add_1(rp + l, rp + l, res_size - l, cy[0]);
+    }
+
+    int sign = mpz_sgn(a.get_mpz_t()) * mpz_sgn(b.get_mpz_t());
+    mpz_limbs_finish(out.get_mpz_t(), sign < 0 ? -static_cast<mp_size_t>(res_size) : static_cast<mp_size_t>(res_size));
+    if (&out == &tmp) res.swap(tmp);
+}
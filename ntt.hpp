@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <gmpxx.h>
+
+/*
+ * Multithreaded big integer multiplication with number-theoretic transform.
+ * The operands are cut into 32-bit coefficients, convolved modulo 3 NTT-friendly primes,
+ * and reconstructed with CRT, which is exact as long as the transform length stays within 2^26.
+ */
+// largest product (in limbs) that NTTMul() can handle, bigger products should go through GMP
+size_t NTTMaxLimbs();
+// res = a * b, using num_threads threads
+void NTTMul(mpz_class& res, const mpz_class& a, const mpz_class& b, int num_threads);
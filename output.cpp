@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cstring>
+
+#include "output.hpp"
+
+mpz_class MpfToFixedPoint(const mpf_class& f, long& frac_bits) {
+    // the mantissa has at most prec + 2 limbs, and a whole number of limbs keeps the shift exact
+    frac_bits = (f.get_prec() / GMP_NUMB_BITS + 3) * GMP_NUMB_BITS;
+    mpf_class t(0, f.get_prec());
+    mpz_class x;
+    mpf_mul_2exp(t.get_mpf_t(), f.get_mpf_t(), frac_bits);
+    mpz_set_f(x.get_mpz_t(), t.get_mpf_t());
+
+    return x;
+}
+
+mpz_class FixedPointToInteger(const mpz_class& x, long frac_bits, int digits, long& int_len) {
+    mpz_class n, half = 1;
+    mpz_ui_pow_ui(n.get_mpz_t(), 10, digits);
+    n *= x;
+    if (frac_bits > 0) {
+        half <<= (frac_bits - 1);
+        n += half;
+        n >>= frac_bits;
+    }
+
+    // the integer part is small, so this is cheap
+    mpz_class int_part = x >> frac_bits;
+    int_len = int_part == 0 ? 1 : int_part.get_str().size();
+
+    return n;
+}
+
+std::string HexDigits(const mpz_class& x, long frac_bits, long first, long count) {
+    mpz_class n;
+    mpz_fdiv_q_2exp(n.get_mpz_t(), x.get_mpz_t(), frac_bits - 4 * (first + count));
+    mpz_fdiv_r_2exp(n.get_mpz_t(), n.get_mpz_t(), 4 * count);
+    std::string hex = n.get_str(16);
+
+    return std::string(count - hex.size(), '0') + hex;
+}
+
+void PowersOf10(std::vector<mpz_class>& pows, long digits) {
+    pows.clear();
+    pows.emplace_back(10);
+    for (long d = 2; d < digits; d <<= 1) {
+        pows.push_back(pows.back() * pows.back());
+    }
+}
+
+long SplitDigits(long digits, const std::vector<mpz_class>& pows, int& k) {
+    k = -1;
+    for (long d = 1; (k + 1) < static_cast<int>(pows.size()) && d < digits; d <<= 1) k++;
+    return k < 0 ? 0 : 1L << k;
+}
+
+void PutDigits(char* buf, long int_len, long offset, long digits, const mpz_class& a) {
+    std::string str = a.get_str();
+    str.insert(0, std::max(digits - static_cast<long>(str.size()), 0L), '0');
+
+    // the part before int_len stays in place, the rest is shifted by the '.'
+    long cut = std::min(std::max(int_len - offset, 0L), digits);
+    memcpy(buf + offset, str.data(), cut);
+    memcpy(buf + offset + cut + 1, str.data() + cut, digits - cut);
+}
+
+long TrimDigits(const char* buf, long int_len, long digits) {
+    long len = int_len + 1 + digits;
+    while (len > int_len + 1 && buf[len - 1] == '0') len--;
+    // no decimal left, drop the '.' as well
+    if (len == int_len + 1) len--;
+    return len;
+}
+
+PiDigits::PiDigits(std::shared_ptr<const char> text, long len, long digits): text_(text), len_(len), digits_(digits) {
+    const char* dot = static_cast<const char*>(memchr(text_.get(), '.', len_));
+    int_len_ = dot ? dot - text_.get() : len_;
+}
+
+std::string PiDigits::Decimals(long begin, long end) const {
+    std::string res(std::max(end - begin, 0L), '0');
+    long first = int_len_ + 1 + begin, last = std::min(int_len_ + 1 + end, len_);
+    if (first < last) memcpy(&res[0], text_.get() + first, last - first);
+
+    return res;
+}
+
+long PiDigits::ExactDecimals() const {
+    // decimals past the text are 0, and the last one is the rounded one
+    long i = std::min(digits_ - 1, len_ - int_len_ - 1) - 1;
+    while (i >= 0 && (text_.get()[int_len_ + 1 + i] == '0' || text_.get()[int_len_ + 1 + i] == '9')) i--;
+
+    return std::max(i, 0L);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <gmpxx.h>
+
+/*
+ * Digit output of a fixed point number x / 2^frac_bits
+ */
+// exact fixed point copy of an mpf, frac_bits is chosen by it
+mpz_class MpfToFixedPoint(const mpf_class& f, long& frac_bits);
+// n = round(x * 10^digits / 2^frac_bits), and the number of digits of its integer part
+mpz_class FixedPointToInteger(const mpz_class& x, long frac_bits, int digits, long& int_len);
+// bits at the end of the precision of pi left out of the hex digits checked by the verifier
+const long HEX_GUARD_BITS = 32;
+// hex digits [first, first+count) after the point of x / 2^frac_bits, 4 * (first+count) <= frac_bits
+std::string HexDigits(const mpz_class& x, long frac_bits, long first, long count);
+
+/*
+ * Divide and conquer binary to decimal conversion.
+ * A number with d digits is split by the biggest 10^(2^k) below it, into a high part and a low part of exactly 2^k digits,
+ * and both parts are converted independently into their slices of the output buffer.
+ * The buffer holds the integer part, then '.', then the decimals, so digit i of the whole number goes to i, or i+1 after int_len.
+ */
+// pows[k] = 10^(2^k), for all 2^k < digits
+void PowersOf10(std::vector<mpz_class>& pows, long digits);
+// number of digits of the low part when splitting a number of digits digits, 0 if it should not be split
+long SplitDigits(long digits, const std::vector<mpz_class>& pows, int& k);
+// write a, which has at most digits digits, with leading zeros as digits [offset, offset+digits)
+void PutDigits(char* buf, long int_len, long offset, long digits, const mpz_class& a);
+// length of the text in buf for a number with the given decimals, without trailing zeros, like mpf output
+long TrimDigits(const char* buf, long int_len, long digits);
+
+/*
+ * Text of pi in memory, as in the output file without the '\n', and the number of decimals it was computed to.
+ * The trailing zeros are trimmed, so the decimals beyond the text are 0.
+ */
+class PiDigits {
+    std::shared_ptr<const char> text_;
+    long len_, int_len_, digits_;
+
+public:
+    PiDigits(std::shared_ptr<const char> text, long len, long digits);
+
+    const char* Text() const {return text_.get();}
+    long Size() const {return len_;}
+    long Digits() const {return digits_;}
+    // decimals [begin, end), end <= Digits()
+    std::string Decimals(long begin, long end) const;
+    // number of leading decimals which are those of pi: the last decimal is rounded,
+    // and the rounding carries up to the last decimal which is neither 0 nor 9
+    long ExactDecimals() const;
+};
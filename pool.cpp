@@ -0,0 +1,48 @@
+#include <utility>
+
+#include "pool.hpp"
+
+void PQTPool::Reset(size_t nodes) {
+    std::vector<mpz_class>(4 * nodes).swap(slots_);
+    nodes_.assign(nodes, PQT());
+    for (size_t i = 0; i < nodes; i++) {
+        nodes_[i].P = &slots_[4 * i];
+        nodes_[i].Q = &slots_[4 * i + 1];
+        nodes_[i].T = &slots_[4 * i + 2];
+    }
+    t2_mods_.assign(nodes, Residues());
+    reserved_.assign(4 * nodes, 0);
+    stats_ = {nodes, 0, 0, 0};
+}
+
+void PQTPool::Reserve(mpz_class* slot, const mpz_class& a, const mpz_class& b) {
+    size_t limbs = mpz_size(a.get_mpz_t()) + mpz_size(b.get_mpz_t()) + 1;
+    mpz_realloc2(slot->get_mpz_t(), limbs * GMP_NUMB_BITS);
+    reserved_[Slot(slot)] = limbs;
+    stats_.reserved++;
+    stats_.reserved_bytes += limbs * sizeof(mp_limb_t);
+}
+
+/*
+ * P1 T2 is smaller than T1 Q2 unless the right child is much smaller, otherwise it takes the place of T,
+ * so that the sum fits in the slot reserved for the larger product.
+ */
+void PQTPool::AddT2(PQT* pqt) {
+    mpz_class& t = *pqt->T;
+    mpz_class& t2 = *T2(pqt);
+    if (mpz_size(t2.get_mpz_t()) > mpz_size(t.get_mpz_t())) {
+        t.swap(t2);
+        std::swap(reserved_[Slot(&t)], reserved_[Slot(&t2)]);
+    }
+    t += t2;
+    mpz_class().swap(t2);
+    reserved_[Slot(&t2)] = 0;
+}
+
+void PQTPool::Release(PQT* pqt) {
+    for (size_t i = 4 * Index(pqt); i < 4 * Index(pqt) + 4; i++) {
+        if (reserved_[i] > 0 && static_cast<size_t>(slots_[i].get_mpz_t()->_mp_alloc) > reserved_[i]) stats_.regrown++;
+        mpz_class().swap(slots_[i]);
+        reserved_[i] = 0;
+    }
+}
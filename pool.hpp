@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "utils.hpp"
+
+/*
+ * The P, Q and T of every subtree of the merge tree of a run, plus the second product of T of its merge (P1 T2),
+ * in mpz slots made once per run. A PQT points into its node of the pool, so a subtree goes through the packs,
+ * the spill store and the checkpoint without any allocation of its own.
+ * A product is written straight into its slot, whose limbs are reserved by master for the sizes of the operands right before,
+ * so that the worker neither allocates nor regrows it. The limbs of a subtree are freed once its parent is merged,
+ * the slots themselves stay until Clear().
+ */
+class PQTPool {
+public:
+    struct Stats {
+        // nodes of the run, slots reserved for a product and their bytes, slots which grew past their reservation anyway
+        size_t nodes, reserved, reserved_bytes, regrown;
+    };
+
+private:
+    // P, Q, T, T2 of every node
+    std::vector<mpz_class> slots_;
+    std::vector<PQT> nodes_;
+    std::vector<Residues> t2_mods_;
+    // limbs reserved in every slot, 0 if it was filled otherwise, e.g. by a leaf
+    std::vector<size_t> reserved_;
+    Stats stats_;
+
+    size_t Index(const PQT* pqt) const {return pqt - nodes_.data();}
+    size_t Slot(const mpz_class* slot) const {return slot - slots_.data();}
+
+public:
+    PQTPool(): stats_() {}
+    PQTPool(const PQTPool&) = delete;
+    PQTPool& operator=(const PQTPool&) = delete;
+
+    // nodes empty nodes, the previous ones are freed
+    void Reset(size_t nodes);
+    void Clear() {Reset(0);}
+    size_t Size() const {return nodes_.size();}
+    PQT* Node(size_t node) {return &nodes_[node];}
+    mpz_class* T2(const PQT* pqt) {return &slots_[4 * Index(pqt) + 3];}
+    Residues* T2Mod(const PQT* pqt) {return &t2_mods_[Index(pqt)];}
+    // the product of a and b is going to be written to slot by a worker, with one more limb for the addition of T2
+    void Reserve(mpz_class* slot, const mpz_class& a, const mpz_class& b);
+    // T += T2 of pqt, and T2 is freed, T2 is not read by anything else then
+    void AddT2(PQT* pqt);
+    // P, Q and T of pqt are not read anymore
+    void Release(PQT* pqt);
+    Stats GetStats() const {return stats_;}
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Work-stealing scheduler, used in place of a single shared blocking queue.
+ * Every worker owns a deque: it pushes and pulls at the back (LIFO, cache hot),
+ * and only when its own deque is empty it steals from the front of the others (FIFO, oldest first).
+ * Threads that are not registered as worker (e.g. master) push round robin, or to a hinted worker.
+ * push() / pull() mirror boost::sync_queue so it can replace one directly.
+ */
+template<typename T>
+class WorkStealingScheduler {
+    struct alignas(64) WorkerDeque {
+        std::mutex mtx;
+        std::deque<T> tasks;
+        // statistics, only written by the owner
+        std::atomic<uint64_t> pulls{0}, steals{0}, idle_ns{0};
+    };
+
+    std::vector<std::unique_ptr<WorkerDeque>> deques_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<int> sleepers_{0};
+    std::atomic<unsigned> next_{0};
+    std::mutex sleep_mtx_;
+    std::condition_variable sleep_cv_;
+
+    // the worker index of the calling thread, -1 if it is not a worker of this scheduler
+    static thread_local const WorkStealingScheduler* owner_;
+    static thread_local int index_;
+
+    void PushTo(int worker, T&& task) {
+        WorkerDeque& d = *deques_[worker];
+        {
+            std::lock_guard<std::mutex> lock(d.mtx);
+            d.tasks.push_back(std::move(task));
+            pending_.fetch_add(1);
+        }
+        if (sleepers_.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mtx_);
+            sleep_cv_.notify_one();
+        }
+    }
+
+    bool TryPop(int worker, T& task) {
+        WorkerDeque& d = *deques_[worker];
+        std::lock_guard<std::mutex> lock(d.mtx);
+        if (d.tasks.empty()) return false;
+        task = std::move(d.tasks.back());
+        d.tasks.pop_back();
+        pending_.fetch_sub(1);
+        return true;
+    }
+
+    bool TrySteal(int victim, T& task) {
+        WorkerDeque& d = *deques_[victim];
+        std::unique_lock<std::mutex> lock(d.mtx, std::try_to_lock);
+        if (!lock.owns_lock() || d.tasks.empty()) return false;
+        task = std::move(d.tasks.front());
+        d.tasks.pop_front();
+        pending_.fetch_sub(1);
+        return true;
+    }
+
+public:
+    struct Stats {
+        uint64_t pulls, steals, idle_ms;
+    };
+
+    explicit WorkStealingScheduler(int num_workers) {
+        for (int i = 0; i < std::max(num_workers, 1); i++) {
+            deques_.emplace_back(new WorkerDeque());
+        }
+    }
+
+    int Size() const {return deques_.size();}
+
+    // bind the calling thread to the deque of worker
+    void Register(int worker) {
+        owner_ = this;
+        index_ = worker % Size();
+    }
+
+    // the worker index of the calling thread, -1 if it is not registered
+    int CurrentWorker() const {return owner_ == this ? index_ : -1;}
+
+    // workers push locally, others push round robin
+    void push(T task) {
+        int worker = CurrentWorker();
+        if (worker < 0) worker = next_.fetch_add(1, std::memory_order_relaxed) % Size();
+        PushTo(worker, std::move(task));
+    }
+
+    // push to the deque of a given worker, e.g. the one which still has the operands in cache
+    void push(T task, int worker) {
+        if (worker < 0) push(std::move(task));
+        else PushTo(worker % Size(), std::move(task));
+    }
+
+    // blocking pull for a registered worker: own deque first, then steal, then sleep
+    void pull(T& task) {
+        int self = std::max(CurrentWorker(), 0);
+        WorkerDeque& d = *deques_[self];
+        std::chrono::steady_clock::time_point idle_start;
+        bool idle = false;
+
+        while (true) {
+            if (TryPop(self, task)) {
+                d.pulls.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+
+            bool stolen = false;
+            for (int i = 1; i < Size() && !stolen; i++) {
+                stolen = TrySteal((self + i) % Size(), task);
+            }
+            if (stolen) {
+                d.pulls.fetch_add(1, std::memory_order_relaxed);
+                d.steals.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+
+            if (!idle) {
+                idle = true;
+                idle_start = std::chrono::steady_clock::now();
+            }
+
+            // sleep until something is pushed
+            std::unique_lock<std::mutex> lock(sleep_mtx_);
+            sleepers_.fetch_add(1);
+            sleep_cv_.wait(lock, [this] {return pending_.load() > 0;});
+            sleepers_.fetch_sub(1);
+        }
+
+        if (idle) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - idle_start).count();
+            d.idle_ns.fetch_add(ns, std::memory_order_relaxed);
+        }
+    }
+
+    Stats GetStats(int worker) const {
+        const WorkerDeque& d = *deques_[worker];
+        return {d.pulls.load(), d.steals.load(), d.idle_ns.load() / 1000000};
+    }
+
+    Stats GetStats() const {
+        Stats total = {0, 0, 0};
+        for (int i = 0; i < Size(); i++) {
+            Stats s = GetStats(i);
+            total.pulls += s.pulls;
+            total.steals += s.steals;
+            total.idle_ms += s.idle_ms;
+        }
+        return total;
+    }
+
+    void ResetStats() {
+        for (auto& d: deques_) {
+            d->pulls = 0;
+            d->steals = 0;
+            d->idle_ns = 0;
+        }
+    }
+};
+
+template<typename T>
+thread_local const WorkStealingScheduler<T>* WorkStealingScheduler<T>::owner_ = nullptr;
+template<typename T>
+thread_local int WorkStealingScheduler<T>::index_ = -1;
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.hpp"
+
+// smallest size of a computation
+static const long SERVER_MIN_DIGITS = 1000;
+// decimals computed beyond the request, so that the rounding of the last decimals rarely reaches it
+static const long SERVER_SLACK_DIGITS = 64;
+
+// the text of a digits file, which stays mapped as long as it is used
+static std::shared_ptr<const PiDigits> MapDigits(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    void* p = fstat(fd, &st) == 0 && st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) return nullptr;
+
+    size_t size = st.st_size;
+    const char* data = static_cast<const char*>(p);
+    const char* text = static_cast<const char*>(memchr(data, '\n', size));
+    long digits = 0;
+    if (!text || sscanf(data, "pi %ld", &digits) != 1 || digits < 0 || data + size - text < 2) {
+        munmap(p, size);
+        return nullptr;
+    }
+    text++;
+    std::shared_ptr<const char> mapped(text, [p, size](const char*) {munmap(p, size);});
+
+    // without the '\n' at the end
+    return std::make_shared<PiDigits>(mapped, data + size - text - 1, digits);
+}
+
+static bool SendAll(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+PiServer::PiServer(PiEngine& engine, const std::string& socket_path, const PiOptions& options):
+    engine_(engine), options_(options), socket_path_(socket_path), digits_path_(socket_path + ".digits"), root_path_(socket_path + ".root"),
+    listen_fd_(-1), stop_(false) {
+    // the root saved for the next computation must be exact
+    options_.truncate = false;
+    options_.save_root = root_path_;
+    best_ = MapDigits(digits_path_);
+    if (best_) std::cerr << " [*] Serving " << best_->Digits() << " digits from " << digits_path_ << std::endl;
+}
+
+PiServer::~PiServer() {
+    Stop();
+}
+
+bool PiServer::Run() {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path_.size() >= sizeof(addr.sun_path)) {
+        std::cerr << " [X] Socket path too long: " << socket_path_ << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path_.c_str());
+    unlink(socket_path_.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        std::cerr << " [X] Cannot listen on " << socket_path_ << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        listen_fd_ = fd;
+    }
+    std::cerr << " [*] Listening on " << socket_path_ << std::endl;
+
+    while (!stop_) {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (stop_) {
+            close(client);
+            break;
+        }
+        client_fds_.push_back(client);
+        std::thread(&PiServer::Serve, this, client).detach();
+    }
+
+    // the clients have left once their fds are gone
+    std::unique_lock<std::mutex> lock(mtx_);
+    clients_cv_.wait(lock, [this]() {return client_fds_.empty();});
+    close(fd);
+    listen_fd_ = -1;
+    unlink(socket_path_.c_str());
+
+    return true;
+}
+
+void PiServer::Stop() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    stop_ = true;
+    if (listen_fd_ >= 0) shutdown(listen_fd_, SHUT_RDWR);
+    for (int fd: client_fds_) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    clients_cv_.wait(lock, [this]() {return client_fds_.empty();});
+}
+
+void PiServer::Serve(int fd) {
+    std::string pending;
+    char buf[4096];
+    for (ssize_t n; !stop_ && (n = recv(fd, buf, sizeof(buf), 0)) > 0;) {
+        pending.append(buf, n);
+        size_t begin = 0;
+        for (size_t end; (end = pending.find('\n', begin)) != std::string::npos; begin = end + 1) {
+            std::string answer = Answer(pending.substr(begin, end - begin));
+            if (!SendAll(fd, answer.data(), answer.size())) break;
+        }
+        pending.erase(0, begin);
+        if (pending.size() > sizeof(buf)) break;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    close(fd);
+    client_fds_.erase(std::find(client_fds_.begin(), client_fds_.end(), fd));
+    clients_cv_.notify_all();
+}
+
+std::string PiServer::Answer(const std::string& line) {
+    long begin, end;
+    char extra;
+    if (sscanf(line.c_str(), "%ld %ld %c", &begin, &end, &extra) != 2) return "ERR usage: {begin} {end}\n";
+    if (begin < 0 || end < begin) return "ERR bad range\n";
+    if (end - begin > SERVER_MAX_SPAN) return "ERR more than " + std::to_string(SERVER_MAX_SPAN) + " decimals\n";
+    if (end > SERVER_MAX_DIGITS) return "ERR beyond " + std::to_string(SERVER_MAX_DIGITS) + " decimals\n";
+
+    while (!stop_) {
+        std::shared_ptr<const PiDigits> best;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            best = best_;
+        }
+        if (best && end <= best->ExactDecimals()) return best->Decimals(begin, end) + "\n";
+
+        long digits;
+        PiFuture future = Request(end, digits);
+        try {
+            while (!stop_ && future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready);
+            if (stop_) break;
+            Install(digits, future.get());
+        } catch (const std::exception& e) {
+            // the next request tries again
+            std::lock_guard<std::mutex> lock(mtx_);
+            pending_.erase(digits);
+            return std::string("ERR ") + e.what() + "\n";
+        }
+    }
+
+    return "ERR stopped\n";
+}
+
+PiFuture PiServer::Request(long end, long& digits) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    // past the digits of the best result, in case its last decimals were not exact
+    digits = SERVER_MIN_DIGITS;
+    while (digits < end + SERVER_SLACK_DIGITS || (best_ && digits <= best_->Digits())) {
+        digits *= 2;
+    }
+    auto it = pending_.lower_bound(digits);
+    if (it != pending_.end()) {
+        digits = it->first;
+        return it->second->Future();
+    }
+
+    PiOptions options = options_;
+    std::error_code ec;
+    if (std::filesystem::exists(root_path_, ec)) options.extend_root = root_path_;
+    std::cerr << " [*] Computing " << digits << " digits for a request up to " << end << std::endl;
+    std::unique_ptr<PiTask>& task = pending_[digits];
+    task = engine_.Compute(digits, options);
+
+    return task->Future();
+}
+
+void PiServer::Install(long digits, const std::shared_ptr<const PiDigits>& text) {
+    std::lock_guard<std::mutex> install_lock(install_mtx_);
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending_.erase(digits);
+        if (best_ && best_->Digits() >= digits) return;
+    }
+
+    // written aside and renamed, the old file stays mapped as long as it is served
+    std::string tmp = digits_path_ + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    bool ok = fp && fprintf(fp, "pi %ld\n", digits) > 0;
+    ok = ok && fwrite(text->Text(), 1, text->Size(), fp) == static_cast<size_t>(text->Size()) && fputc('\n', fp) != EOF;
+    ok = (fp && fclose(fp) == 0) && ok;
+    std::shared_ptr<const PiDigits> mapped = ok && rename(tmp.c_str(), digits_path_.c_str()) == 0 ? MapDigits(digits_path_) : nullptr;
+    if (!mapped) {
+        std::cerr << " [X] Cannot write " << digits_path_ << ", serving the digits from memory" << std::endl;
+        remove(tmp.c_str());
+        mapped = text;
+    }
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    best_ = mapped;
+}
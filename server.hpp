@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.hpp"
+
+// longest answer to one request
+const long SERVER_MAX_SPAN = 1L << 26;
+// most decimals a request may reach
+const long SERVER_MAX_DIGITS = 1L << 30;
+
+/*
+ * Daemon serving the decimals of pi on a Unix socket, one request per line: "{begin} {end}\n" is answered with
+ * the decimals [begin, end) and '\n', or with "ERR {reason}\n".
+ * The largest result so far is kept in {socket}.digits ("pi {digits}\n" then the text) and memory-mapped from there,
+ * so it is served again after a restart. A request beyond it starts a computation of the next size 1000 * 2^k,
+ * which extends the root of the merge tree saved in {socket}.root by the previous one, instead of computing all the terms.
+ * The requests waiting for the same or a smaller size wait for the same computation.
+ */
+class PiServer {
+    PiEngine& engine_;
+    PiOptions options_;
+    std::string socket_path_, digits_path_, root_path_;
+    int listen_fd_;
+    std::atomic<bool> stop_;
+
+    std::mutex mtx_;
+    std::shared_ptr<const PiDigits> best_;
+    // computations by digits, a task dropped is cancelled
+    std::map<long, std::unique_ptr<PiTask>> pending_;
+    // only one result is written at a time
+    std::mutex install_mtx_;
+
+    // clients
+    std::condition_variable clients_cv_;
+    std::vector<int> client_fds_;
+
+    void Serve(int fd);
+    std::string Answer(const std::string& line);
+    // the computation which gives the decimals up to end, and its digits
+    PiFuture Request(long end, long& digits);
+    void Install(long digits, const std::shared_ptr<const PiDigits>& text);
+
+public:
+    // options: of every computation, but for the root files
+    PiServer(PiEngine& engine, const std::string& socket_path, const PiOptions& options = PiOptions());
+    ~PiServer();
+    PiServer(const PiServer&) = delete;
+    PiServer& operator=(const PiServer&) = delete;
+
+    // accept clients until Stop(), false if the socket cannot be listened on
+    bool Run();
+    // thread-safe, the clients are disconnected
+    void Stop();
+};
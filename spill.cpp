@@ -0,0 +1,261 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "spill.hpp"
+
+static size_t PageSize() {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+SpillStore::SpillStore(size_t budget, const std::vector<std::string>& dirs):
+    budget_(budget), mem_bytes_(0), next_file_(0), stats_({0, 0, 0, 0}), stop_(false) {
+    for (size_t i = 0; i < dirs.size(); i++) {
+        std::string path = dirs[i] + "/pi_spill_" + std::to_string(getpid()) + "_" + std::to_string(i) + ".bin";
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) continue;
+        // the file lives as long as it is open, so nothing is left behind, even after a crash
+        unlink(path.c_str());
+        fds_.push_back(fd);
+        file_ends_.push_back(0);
+    }
+    // without any usable directory, everything stays in memory
+    if (fds_.empty()) budget_ = static_cast<size_t>(-1);
+
+    thread_ = std::thread(&SpillStore::IOThread, this);
+}
+
+SpillStore::~SpillStore() {
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+
+    for (int fd: fds_) {
+        close(fd);
+    }
+}
+
+/*
+ * The blocks of the region are allocated before it is mapped, so that a full disk is an error here
+ * instead of a SIGBUS in memcpy() of a sparse file. The limbs of x are not freed.
+ */
+bool SpillStore::WriteMpz(const mpz_class& x, Region& region, std::string& error) {
+    region = {next_file_, file_ends_[next_file_], mpz_size(x.get_mpz_t()), mpz_sgn(x.get_mpz_t())};
+    // round robin, so that the directories (disks) share the traffic
+    next_file_ = (next_file_ + 1) % fds_.size();
+    if (region.limbs == 0) return true;
+
+    int fd = fds_[region.file];
+    size_t len = region.limbs * sizeof(mp_limb_t);
+    file_ends_[region.file] += (len + PageSize() - 1) / PageSize() * PageSize();
+    if (fallocate(fd, 0, region.offset, len) < 0) {
+        error = std::string("cannot allocate scratch space: ") + strerror(errno);
+        return false;
+    }
+
+    void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, region.offset);
+    if (p == MAP_FAILED) {
+        error = std::string("cannot map scratch file: ") + strerror(errno);
+        return false;
+    }
+    memcpy(p, mpz_limbs_read(x.get_mpz_t()), len);
+    // make sure it is on disk before the limbs are freed, then drop it from the page cache
+    bool synced = msync(p, len, MS_SYNC) == 0;
+    if (!synced) error = std::string("cannot write scratch file: ") + strerror(errno);
+    munmap(p, len);
+    if (synced) posix_fadvise(fd, region.offset, len, POSIX_FADV_DONTNEED);
+
+    return synced;
+}
+
+bool SpillStore::ReadMpz(mpz_class& x, const Region& region, std::string& error) {
+    if (region.limbs == 0) {
+        x = 0;
+        return true;
+    }
+
+    int fd = fds_[region.file];
+    size_t len = region.limbs * sizeof(mp_limb_t);
+    void* p = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, region.offset);
+    if (p == MAP_FAILED) {
+        error = std::string("cannot map scratch file: ") + strerror(errno);
+        return false;
+    }
+    madvise(p, len, MADV_WILLNEED);
+    mp_limb_t* limbs = mpz_limbs_write(x.get_mpz_t(), region.limbs);
+    memcpy(limbs, p, len);
+    mpz_limbs_finish(x.get_mpz_t(), region.sign < 0 ? -static_cast<mp_size_t>(region.limbs) : region.limbs);
+    munmap(p, len);
+
+    // the region is never read again, give its blocks back to the file system
+    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, region.offset, len);
+
+    return true;
+}
+
+/*
+ * The limbs are only freed once P, Q and T are all written, otherwise the regions already written are given back.
+ */
+bool SpillStore::Spill(Entry& entry, std::string& error) {
+    if (before_spill_) before_spill_(entry.pqt);
+    mpz_class* x[3] = {entry.pqt->P, entry.pqt->Q, entry.pqt->T};
+    for (int i = 0; i < 3; i++) {
+        if (WriteMpz(*x[i], entry.regions[i], error)) continue;
+        for (int j = 0; j <= i; j++) {
+            const Region& region = entry.regions[j];
+            if (region.limbs > 0) fallocate(fds_[region.file], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, region.offset, region.limbs * sizeof(mp_limb_t));
+        }
+        return false;
+    }
+
+    // free the limbs
+    for (int i = 0; i < 3; i++) {
+        mpz_class().swap(*x[i]);
+    }
+
+    return true;
+}
+
+bool SpillStore::Load(Entry& entry, std::string& error) {
+    return ReadMpz(*entry.pqt->P, entry.regions[0], error) && ReadMpz(*entry.pqt->Q, entry.regions[1], error)
+        && ReadMpz(*entry.pqt->T, entry.regions[2], error);
+}
+
+/*
+ * Over the budget, spill the PQT in memory merged last.
+ * Otherwise, read back the spilled PQT merged first, if it fits.
+ * The entry is never erased while the lock is released, since Acquire() waits for STATE_SPILLING and STATE_LOADING.
+ */
+void SpillStore::IOThread() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (!stop_) {
+        Entry* entry = nullptr;
+        if (mem_bytes_ > budget_) {
+            for (auto it = entries_.rbegin(); it != entries_.rend(); ++it) {
+                if (it->second.state == STATE_MEMORY) {
+                    entry = &it->second;
+                    break;
+                }
+            }
+        }
+        if (entry) {
+            entry->state = STATE_SPILLING;
+            lock.unlock();
+            std::string error;
+            bool spilled = Spill(*entry, error);
+            lock.lock();
+            if (spilled) {
+                entry->state = STATE_DISK;
+                mem_bytes_ -= entry->bytes;
+                stats_.written += entry->bytes;
+            } else {
+                // the scratch space is unusable, everything stays in memory from now on
+                entry->state = STATE_MEMORY;
+                entry->error = "cannot spill, " + error + ", kept in memory";
+                budget_ = static_cast<size_t>(-1);
+            }
+            cv_.notify_all();
+            continue;
+        }
+
+        for (auto& it: entries_) {
+            if (it.second.state == STATE_DISK) {
+                if (mem_bytes_ + it.second.bytes <= budget_) entry = &it.second;
+                break;
+            }
+        }
+        if (entry) {
+            entry->state = STATE_LOADING;
+            mem_bytes_ += entry->bytes;
+            lock.unlock();
+            std::string error;
+            bool loaded = Load(*entry, error);
+            lock.lock();
+            if (loaded) {
+                entry->state = STATE_MEMORY;
+                stats_.read += entry->bytes;
+            } else {
+                entry->state = STATE_FAILED;
+                entry->error = "cannot read back, " + error;
+                mem_bytes_ -= entry->bytes;
+            }
+            cv_.notify_all();
+            continue;
+        }
+
+        cv_.wait(lock);
+    }
+}
+
+void SpillStore::Hold(PQT* pqt, long order) {
+    size_t bytes = (mpz_size(pqt->P->get_mpz_t()) + mpz_size(pqt->Q->get_mpz_t()) + mpz_size(pqt->T->get_mpz_t())) * sizeof(mp_limb_t);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    Entry& entry = entries_[order];
+    entry.pqt = pqt;
+    entry.bytes = bytes;
+    entry.state = STATE_MEMORY;
+    orders_[pqt] = order;
+    mem_bytes_ += bytes;
+    stats_.peak = std::max(stats_.peak, mem_bytes_);
+    cv_.notify_all();
+}
+
+void SpillStore::Acquire(PQT* pqt) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    auto order = orders_.find(pqt);
+    if (order == orders_.end()) return;
+    Entry& entry = entries_[order->second];
+
+    auto start = std::chrono::steady_clock::now();
+    cv_.wait(lock, [&] {return entry.state == STATE_MEMORY || entry.state == STATE_DISK || entry.state == STATE_FAILED;});
+    if (entry.state == STATE_DISK) {
+        // not prefetched in time, read it here
+        entry.state = STATE_LOADING;
+        mem_bytes_ += entry.bytes;
+        lock.unlock();
+        std::string error;
+        bool loaded = Load(entry, error);
+        lock.lock();
+        if (loaded) {
+            stats_.read += entry.bytes;
+        } else {
+            entry.state = STATE_FAILED;
+            entry.error = "cannot read back, " + error;
+            mem_bytes_ -= entry.bytes;
+        }
+    }
+    stats_.stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::string error = entry.error;
+    size_t bytes = entry.bytes;
+    bool failed = entry.state == STATE_FAILED;
+    if (!failed) mem_bytes_ -= entry.bytes;
+    entries_.erase(order->second);
+    orders_.erase(order);
+    // there may be room to prefetch now
+    cv_.notify_all();
+    lock.unlock();
+
+    if (!error.empty()) std::cerr << " [X] Spill: a PQT of " << (bytes >> 20) << " MB " << error << std::endl;
+    if (failed) throw std::runtime_error("spill: " + error);
+}
+
+void SpillStore::SetBeforeSpill(const std::function<void(PQT*)>& before_spill) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    before_spill_ = before_spill;
+}
+
+SpillStore::Stats SpillStore::GetStats() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return stats_;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.hpp"
+
+/*
+ * Out-of-core storage of the PQT which master holds between merge levels, under a RAM budget.
+ * When the held PQT exceed the budget, an I/O thread writes the ones merged last into mmap'd scratch files,
+ * spread on several directories, and frees their limbs.
+ * Since the merge order is known, the I/O thread reads back the spilled PQT merged next as soon as they fit in the budget,
+ * so that the reads overlap the multiplications of the workers, and Acquire() only blocks when a PQT is still on disk.
+ * Only the limbs move: the mpz_class objects stay in their slots of the pool, so every PQT pointing to them stays valid.
+ */
+class SpillStore {
+public:
+    struct Stats {
+        size_t written, read, peak;
+        double stall_ms;
+    };
+
+private:
+    // STATE_FAILED: the PQT could not be read back, its limbs are lost
+    enum State {STATE_MEMORY, STATE_SPILLING, STATE_DISK, STATE_LOADING, STATE_FAILED};
+
+    // place of one spilled integer
+    struct Region {
+        int file;
+        size_t offset, limbs;
+        int sign;
+    };
+
+    struct Entry {
+        PQT* pqt;
+        size_t bytes;
+        State state;
+        Region regions[3];
+        // why it was kept in memory or could not be read back, shown by Acquire()
+        std::string error;
+    };
+
+    size_t budget_, mem_bytes_;
+    std::vector<int> fds_;
+    std::vector<size_t> file_ends_;
+    int next_file_;
+    // keyed by merge order
+    std::map<long, Entry> entries_;
+    std::unordered_map<PQT*, long> orders_;
+    Stats stats_;
+
+    std::thread thread_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool stop_;
+    std::function<void(PQT*)> before_spill_;
+
+    void IOThread();
+    // false with the error if it failed, then the limbs of the PQT are left as they were
+    bool Spill(Entry& entry, std::string& error);
+    bool Load(Entry& entry, std::string& error);
+    bool WriteMpz(const mpz_class& x, Region& region, std::string& error);
+    bool ReadMpz(mpz_class& x, const Region& region, std::string& error);
+
+public:
+    SpillStore(size_t budget, const std::vector<std::string>& dirs);
+    ~SpillStore();
+    SpillStore(const SpillStore&) = delete;
+    SpillStore& operator=(const SpillStore&) = delete;
+
+    // master holds pqt until it is merged, order is its position in the merge order, the smallest is merged first
+    void Hold(PQT* pqt, long order);
+    // pqt is going to be merged: wait until it is in memory, and stop holding it
+    // throws std::runtime_error if it was spilled and cannot be read back
+    void Acquire(PQT* pqt);
+    // called by the I/O thread before the limbs of pqt are freed, e.g. to wait until something else is done reading them
+    void SetBeforeSpill(const std::function<void(PQT*)>& before_spill);
+    Stats GetStats();
+};
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "trace.hpp"
+
+// ring buffer of one thread, kept after the thread exits until the trace is dumped
+struct TraceBuffer {
+    std::string name;
+    std::vector<TraceEvent> events;
+    // events recorded so far, the last events.size() of them are kept
+    std::atomic<size_t> count{0};
+};
+
+std::atomic<bool> trace_enabled{false};
+
+static std::mutex trace_mtx;
+static std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+static size_t trace_capacity = TRACE_DEFAULT_EVENTS;
+static std::chrono::steady_clock::time_point trace_origin;
+static thread_local TraceBuffer* thread_buffer = nullptr;
+static thread_local std::string thread_name;
+
+void TraceStart(size_t events_per_thread) {
+    std::lock_guard<std::mutex> lock(trace_mtx);
+    trace_capacity = std::max<size_t>(events_per_thread, 1);
+    trace_origin = std::chrono::steady_clock::now();
+    trace_enabled.store(true, std::memory_order_release);
+}
+
+int64_t TraceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_origin).count();
+}
+
+void TraceThread(const std::string& name) {
+    thread_name = name;
+    if (!thread_buffer) return;
+    std::lock_guard<std::mutex> lock(trace_mtx);
+    thread_buffer->name = name;
+}
+
+void TraceRecord(const TraceEvent& event) {
+    if (!thread_buffer) {
+        std::lock_guard<std::mutex> lock(trace_mtx);
+        trace_buffers.emplace_back(new TraceBuffer());
+        thread_buffer = trace_buffers.back().get();
+        thread_buffer->name = thread_name.empty() ? "thread " + std::to_string(trace_buffers.size() - 1) : thread_name;
+        thread_buffer->events.resize(trace_capacity);
+    }
+
+    size_t count = thread_buffer->count.load(std::memory_order_relaxed);
+    thread_buffer->events[count % thread_buffer->events.size()] = event;
+    thread_buffer->count.store(count + 1, std::memory_order_release);
+}
+
+bool TraceDump(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) return false;
+
+    std::lock_guard<std::mutex> lock(trace_mtx);
+    size_t written = 0, dropped = 0;
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t tid = 0; tid < trace_buffers.size(); tid++) {
+        const TraceBuffer& buffer = *trace_buffers[tid];
+        fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"%s\"}}",
+                tid ? ",\n" : "", tid, buffer.name.c_str());
+
+        size_t count = buffer.count.load(std::memory_order_acquire), size = buffer.events.size();
+        size_t first = count > size ? count - size : 0;
+        dropped += first;
+        for (size_t i = first; i < count; i++) {
+            const TraceEvent& e = buffer.events[i % size];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                    e.name, e.cat, tid, e.begin / 1e3, (e.end - e.begin) / 1e3);
+            const char* sep = "";
+            if (e.id >= 0) {
+                fprintf(fp, "\"id\": %d", e.id);
+                sep = ", ";
+            }
+            if (e.n2 > 0) {
+                fprintf(fp, "%s\"n1\": %ld, \"n2\": %ld", sep, e.n1, e.n2);
+                sep = ", ";
+            }
+            if (e.a_bits > 0) {
+                fprintf(fp, "%s\"a_bits\": %ld, \"b_bits\": %ld", sep, e.a_bits, e.b_bits);
+                sep = ", ";
+            }
+            if (e.queued >= 0) fprintf(fp, "%s\"queued_us\": %.3f", sep, e.queued / 1e3);
+            fprintf(fp, "}}");
+            written++;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    bool ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+    if (ok) std::cerr << " [*] Trace: " << written << " events of " << trace_buffers.size() << " threads written to " << path
+                      << (dropped ? ", " + std::to_string(dropped) + " older events dropped" : "") << std::endl;
+
+    return ok;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+ * Per-thread tracing of the tasks of the workers and of the stages of master, dumped as Chrome trace JSON
+ * (chrome://tracing or ui.perfetto.dev). Every thread records into its own ring buffer without locks,
+ * and keeps the last events when it is full. Before TraceStart(), recording only costs the test of one flag.
+ */
+// events kept per thread by default, about 4 MB each
+const size_t TRACE_DEFAULT_EVENTS = 1 << 16;
+
+struct TraceEvent {
+    // static strings: the kind of task or stage, and "task", "idle" or "master"
+    const char* name;
+    const char* cat;
+    // ns since TraceStart()
+    int64_t begin, end;
+    // ns the task waited in its queue, -1 if unknown
+    int64_t queued;
+    // id of the task, terms n1, n2 if n2 > 0, bits of the operands of a product if a_bits > 0
+    int id;
+    long n1, n2;
+    long a_bits, b_bits;
+};
+
+extern std::atomic<bool> trace_enabled;
+
+inline bool TraceEnabled() {return trace_enabled.load(std::memory_order_relaxed);}
+// the events of every thread are recorded from now on
+void TraceStart(size_t events_per_thread = TRACE_DEFAULT_EVENTS);
+// ns since TraceStart()
+int64_t TraceNow();
+// name of the track of the calling thread in the trace, it may be given before TraceStart()
+void TraceThread(const std::string& name);
+void TraceRecord(const TraceEvent& event);
+// write the events recorded so far, while the traced threads are idle, false if the file cannot be written
+bool TraceDump(const std::string& path);
+
+// a stage of the calling thread, from its construction to its destruction
+class TraceSpan {
+    const char* name_;
+    const char* cat_;
+    int64_t begin_;
+
+public:
+    explicit TraceSpan(const char* name, const char* cat = "master"): name_(name), cat_(cat), begin_(TraceEnabled() ? TraceNow() : -1) {}
+    ~TraceSpan() {
+        if (begin_ >= 0) TraceRecord({name_, cat_, begin_, TraceNow(), -1, -1, 0, 0, 0, 0});
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
@@ -0,0 +1,83 @@
+#include <algorithm>
+
+#include "truncate.hpp"
+
+/*
+ * The bounds are log2 of tiny numbers, like -1e7, where a double still has about 1e-9 of resolution:
+ * every sum is rounded up by a margin far above the rounding of the double operations.
+ */
+static const double ERROR_MARGIN = 1e-6;
+
+// log2(2^a + 2^b), rounded up
+static double ErrorAdd(double a, double b) {
+    if (a == -INFINITY) return b;
+    if (b == -INFINITY) return a;
+    double hi = std::max(a, b), lo = std::min(a, b);
+
+    return hi + log2(1 + exp2(lo - hi)) + ERROR_MARGIN;
+}
+
+static double ErrorSum(std::initializer_list<double> terms) {
+    double sum = -INFINITY;
+    for (double term: terms) {
+        sum = ErrorAdd(sum, term);
+    }
+
+    return sum;
+}
+
+// log2 of a bound of |x| / |y|, with 2^(bits-1) <= |y| and |x| < 2^bits, y != 0
+static double RatioBound(const mpz_class& x, const mpz_class& y) {
+    if (sgn(x) == 0) return -INFINITY;
+
+    return static_cast<double>(mpz_sizeinbase(x.get_mpz_t(), 2)) - static_cast<double>(mpz_sizeinbase(y.get_mpz_t(), 2)) + 1;
+}
+
+/*
+ * With e the absolute errors and Q = Q1 Q2, relative to which the errors of the merge are:
+ * eQ = eQ1 Q2 + Q1 eQ2 + eQ1 eQ2
+ * eT = eT1 Q2 + T1 eQ2 + eT1 eQ2 + eP1 T2 + P1 eT2 + eP1 eT2
+ * eP = eP1 P2 + P1 eP2 + eP1 eP2
+ * P of the right spine is 0 and has no bound, but it is never read.
+ */
+std::array<double, 3> MergeError(const PQT& left, const PQT& right) {
+    const std::array<double, 3>& l = left.err;
+    const std::array<double, 3>& r = right.err;
+    double p1 = RatioBound(*left.P, *left.Q), t1 = RatioBound(*left.T, *left.Q);
+    double p2 = RatioBound(*right.P, *right.Q), t2 = RatioBound(*right.T, *right.Q);
+
+    std::array<double, 3> res;
+    res[0] = ErrorSum({l[0] + p2, p1 + r[0], l[0] + r[0]});
+    res[1] = ErrorSum({l[1], r[1], l[1] + r[1]});
+    res[2] = ErrorSum({l[2], t1 + r[1], l[2] + r[1], l[0] + t2, p1 + r[2], l[0] + r[2]});
+
+    return res;
+}
+
+long TruncatePQT(PQT& pqt, long bits) {
+    long shift = (static_cast<long>(mpz_sizeinbase(pqt.Q->get_mpz_t(), 2)) - bits) / GMP_NUMB_BITS * GMP_NUMB_BITS;
+    if (shift <= 0) return 0;
+
+    mpz_tdiv_q_2exp(pqt.P->get_mpz_t(), pqt.P->get_mpz_t(), shift);
+    mpz_tdiv_q_2exp(pqt.Q->get_mpz_t(), pqt.Q->get_mpz_t(), shift);
+    mpz_tdiv_q_2exp(pqt.T->get_mpz_t(), pqt.T->get_mpz_t(), shift);
+    // the errors scale with Q, and the dropped limbs add less than 1 unit to each, with Q >= 2^(bits(Q)-1)
+    double unit = 1.0 - static_cast<double>(mpz_sizeinbase(pqt.Q->get_mpz_t(), 2));
+    for (double& err: pqt.err) {
+        err = ErrorAdd(err, unit);
+    }
+
+    return shift;
+}
+
+/*
+ * With F = A Q + T, eF = A eQ + eT, and pi ~ Q / F has the relative error eQ / Q + eF / F,
+ * plus their products, which are covered by the doubled second term.
+ */
+double PiErrorBound(const PQT& pqt, const mpz_class& A) {
+    mpz_class F = A * *pqt.Q + *pqt.T;
+    double log2_a = static_cast<double>(mpz_sizeinbase(A.get_mpz_t(), 2));
+    double f = ErrorAdd(log2_a + pqt.err[1], pqt.err[2]) + RatioBound(*pqt.Q, F);
+
+    return ErrorAdd(pqt.err[1], f + 1);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "utils.hpp"
+
+/*
+ * Truncated top merges of the binary splitting.
+ * The final stage only needs T/Q to the precision of pi, but the operands of the last merges have more bits than that.
+ * Such an operand loses its low limbs: P, Q and T are shifted right by the same number of limbs, until Q has the bits
+ * kept. A common factor of P, Q and T does not change pi, so only the dropped limbs are an error, less than 1 unit each.
+ * Every PQT carries bounds of the errors of its P, Q and T relative to its Q, as log2, which the merges propagate
+ * from the sizes of their operands, so that the relative error of pi is bounded at the end.
+ */
+// bits kept beyond the precision of pi
+const long TRUNCATE_GUARD_BITS = 128;
+
+// error bounds of the merge of left and right, which must be the operands its products were computed from
+std::array<double, 3> MergeError(const PQT& left, const PQT& right);
+// drop the low limbs of P, Q and T so that Q has at most bits bits, returns the number of bits dropped
+long TruncatePQT(PQT& pqt, long bits);
+// log2 of the bound of the relative error of pi = D sqrt(E) Q / (A Q + T), from the errors of pqt
+double PiErrorBound(const PQT& pqt, const mpz_class& A);
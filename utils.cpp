@@ -10,51 +10,66 @@ using MS = std::chrono::milliseconds;
 
 ReqPack::ReqPack(): id_(-1), n1_(-1), n2_(-1), type_(TYPE_UNKNOWN) {};
 ReqPack::ReqPack(int id): id_(id), type_(TYPE_MINIMAL) {};
-ReqPack::ReqPack(int id, int n1, int n2): id_(id), n1_(n1), n2_(n2), type_(TYPE_COMPUTE) {};
-ReqPack::ReqPack(int id, std::shared_ptr<mpz_class> a, std::shared_ptr<mpz_class> b): id_(id), a_(a), b_(b), type_(TYPE_COMBINE) {};
+ReqPack::ReqPack(int id, int n1, int n2, PQT* out): id_(id), n1_(n1), n2_(n2), type_(TYPE_COMPUTE), pqt_(out) {};
+ReqPack::ReqPack(int id, int n1, int n2, std::shared_ptr<mpz_class> a): id_(id), n1_(n1), n2_(n2), type_(TYPE_CONVERT), a_(a) {};
+ReqPack::ReqPack(int id, const mpz_class* a, const mpz_class* b, mpz_class* out, const Residues* ra, const Residues* rb, Residues* rout):
+    id_(id), type_(TYPE_COMBINE), pa_(a), pb_(b), out_(out), ra_(ra), rb_(rb), rout_(rout) {};
 ReqPack::ReqPack(int id, std::shared_ptr<mpf_class> fa): id_(id), fa_(fa), type_(TYPE_COMBINE) {};
 ReqPack::ReqPack(int id, std::shared_ptr<mpf_class> fa, std::shared_ptr<mpf_class> fb): id_(id), fa_(fa), fb_(fb), type_(TYPE_COMBINE) {};
-ReqPack::ReqPack(int id, std::shared_ptr<mpz_class> a, std::shared_ptr<mpz_class> b, std::shared_ptr<mpz_class> c, std::shared_ptr<mpz_class> d): id_(id), a_(a), b_(b), c_(c), d_(d), type_(TYPE_COMBINE2) {};
+ReqPack::ReqPack(int id, PQT* pqt, const mpz_class* t2): id_(id), type_(TYPE_COMBINE2), pqt_(pqt), pa_(t2) {};
 int ReqPack::GetID() {return id_;};
 int ReqPack::GetN1() {return n1_;};
 int ReqPack::GetN2() {return n2_;};
 PackType ReqPack::GetType() {return type_;};
-std::shared_ptr<mpz_class> ReqPack::Geta() {return a_;};
-std::shared_ptr<mpz_class> ReqPack::Getb() {return b_;};
-std::shared_ptr<mpz_class> ReqPack::Getc() {return c_;};
-std::shared_ptr<mpz_class> ReqPack::Getd() {return d_;};
-std::shared_ptr<mpf_class> ReqPack::Getfa() {return fa_;};
-std::shared_ptr<mpf_class> ReqPack::Getfb() {return fb_;};
+const std::shared_ptr<mpz_class>& ReqPack::Geta() {return a_;};
+const std::shared_ptr<mpf_class>& ReqPack::Getfa() {return fa_;};
+const std::shared_ptr<mpf_class>& ReqPack::Getfb() {return fb_;};
+const mpz_class* ReqPack::Getpa() {return pa_;};
+const mpz_class* ReqPack::Getpb() {return pb_;};
+mpz_class* ReqPack::Getout() {return out_;};
+PQT* ReqPack::GetPQT() {return pqt_;};
+const Residues* ReqPack::GetRa() {return ra_;};
+const Residues* ReqPack::GetRb() {return rb_;};
+Residues* ReqPack::GetRout() {return rout_;};
+int64_t ReqPack::GetQueued() {return queued_;};
 bool ReqPack::IsValid() {return id_ != -1;};
 void ReqPack::Invalidate() {
     id_ = -1;
     a_ = nullptr;
-    b_ = nullptr;
-    c_ = nullptr;
-    d_ = nullptr;
+    pqt_ = nullptr;
     fa_ = nullptr;
     fb_ = nullptr;
+    pa_ = nullptr;
+    pb_ = nullptr;
+    out_ = nullptr;
+    ra_ = nullptr;
+    rb_ = nullptr;
+    rout_ = nullptr;
 };
 
-RespPack::RespPack(): id_(-1), n1_(-1), n2_(-1), result_({}), type_(TYPE_UNKNOWN) {};
-RespPack::RespPack(int id, int n1, int n2, std::shared_ptr<PQT> result): id_(id), n1_(n1), n2_(n2), result_(result), type_(TYPE_COMPUTE) {};
-RespPack::RespPack(int id, std::shared_ptr<PQT> result): id_(id), n1_(-1), n2_(-1), result_(result), type_(TYPE_COMPUTE) {};
-RespPack::RespPack(ReqPack& req_pack, std::shared_ptr<PQT> result): id_(req_pack.GetID()), n1_(req_pack.GetN1()), n2_(req_pack.GetN2()), result_(result), type_(req_pack.GetType()) {};
-RespPack::RespPack(int id, std::shared_ptr<mpz_class> a): id_(id), a_(a), type_(TYPE_COMBINE) {};
-RespPack::RespPack(ReqPack& req_pack, std::shared_ptr<mpz_class> a): id_(req_pack.GetID()), a_(a), type_(req_pack.GetType()) {};
-RespPack::RespPack(ReqPack& req_pack, std::shared_ptr<mpf_class> fa): id_(req_pack.GetID()), fa_(fa), type_(req_pack.GetType()) {};
+RespPack::RespPack(): id_(-1), n1_(-1), n2_(-1), worker_(-1), type_(TYPE_UNKNOWN) {};
+RespPack::RespPack(int id, int n1, int n2, PQT* result): id_(id), n1_(n1), n2_(n2), worker_(-1), result_(result), type_(TYPE_COMPUTE) {};
+RespPack::RespPack(int id, PQT* result): id_(id), n1_(-1), n2_(-1), worker_(-1), result_(result), type_(TYPE_COMPUTE) {};
+RespPack::RespPack(ReqPack& req_pack, PQT* result): id_(req_pack.GetID()), n1_(req_pack.GetN1()), n2_(req_pack.GetN2()), worker_(-1), result_(result), type_(req_pack.GetType()) {};
+RespPack::RespPack(ReqPack& req_pack): id_(req_pack.GetID()), n1_(-1), n2_(-1), worker_(-1), type_(req_pack.GetType()) {};
+RespPack::RespPack(ReqPack& req_pack, std::shared_ptr<mpf_class> fa): id_(req_pack.GetID()), worker_(-1), fa_(fa), type_(req_pack.GetType()) {};
 int RespPack::GetID() {return id_;};
 int RespPack::GetN1() {return n1_;};
 int RespPack::GetN2() {return n2_;};
-std::shared_ptr<PQT> RespPack::GetResult() {return result_;};
+PQT* RespPack::GetResult() {return result_;};
+PQT* RespPack::TakeResult() {
+    PQT* result = result_;
+    result_ = nullptr;
+    return result;
+};
 PackType RespPack::GetType() {return type_;};
-std::shared_ptr<mpz_class> RespPack::Geta() {return a_;};
-std::shared_ptr<mpf_class> RespPack::Getfa() {return fa_;};
+const std::shared_ptr<mpf_class>& RespPack::Getfa() {return fa_;};
+int RespPack::GetWorker() {return worker_;};
+void RespPack::SetWorker(int worker) {worker_ = worker;};
 bool RespPack::IsValid() {return id_ != -1;};
 void RespPack::Invalidate() {
     id_ = -1;
     result_ = nullptr;
-    a_ = nullptr;
     fa_ = nullptr;
 };
 
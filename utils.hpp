@@ -1,41 +1,87 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <memory>
+#include <thread>
 #include <gmpxx.h>
 
-enum PackType {TYPE_UNKNOWN, TYPE_MINIMAL, TYPE_COMPUTE, TYPE_COMBINE, TYPE_COMBINE2};
+#include "trace.hpp"
+
+enum PackType {TYPE_UNKNOWN, TYPE_MINIMAL, TYPE_COMPUTE, TYPE_COMBINE, TYPE_COMBINE2, TYPE_CONVERT};
 
 struct NativePQT {
     mpz_class P, Q, T;
 };
 
+// most word-size primes of the modular check, see modcheck.hpp
+const int MODCHECK_MAX_PRIMES = 4;
+typedef std::array<uint64_t, MODCHECK_MAX_PRIMES> Residues;
+
+// P, Q and T are slots of a PQTPool, see pool.hpp, or of a NativePQT
 struct PQT {
-    std::shared_ptr<mpz_class> P, Q, T;
+    mpz_class* P = nullptr;
+    mpz_class* Q = nullptr;
+    mpz_class* T = nullptr;
+    // log2 of the bounds of the errors of P, Q and T relative to Q, -inf while exact, see truncate.hpp
+    std::array<double, 3> err = {{-INFINITY, -INFINITY, -INFINITY}};
+    // P, Q and T modulo the primes of the modular check, only kept while it is on
+    std::array<Residues, 3> mod = {};
 };
 
+/*
+ * Packs are move-only, so that they go through the queues without touching any reference count.
+ * A TYPE_COMBINE request only points to its operands and to the slot of its product, which are nodes of the PQTPool of master:
+ * the worker writes the product in place and answers with the id alone. A TYPE_COMPUTE or TYPE_COMBINE2 request points to
+ * the node the worker fills, and its response points to the same node.
+ */
 class ReqPack {
     int id_;
     int n1_;
     int n2_;
     PackType type_;
-    std::shared_ptr<mpz_class> a_, b_, c_, d_;
+    std::shared_ptr<mpz_class> a_;
+    PQT* pqt_ = nullptr;
     std::shared_ptr<mpf_class> fa_, fb_;
+    const mpz_class* pa_ = nullptr;
+    const mpz_class* pb_ = nullptr;
+    mpz_class* out_ = nullptr;
+    // residues of the operands and of the product for the modular check, nullptr if unknown or not wanted
+    const Residues* ra_ = nullptr;
+    const Residues* rb_ = nullptr;
+    Residues* rout_ = nullptr;
+    // TraceNow() when the pack was made, right before it is queued, -1 if not traced
+    int64_t queued_ = TraceEnabled() ? TraceNow() : -1;
 public:
     ReqPack();
     ReqPack(int id);
-    ReqPack(int id, int n1, int n2);
-    ReqPack(int id, std::shared_ptr<mpz_class> a, std::shared_ptr<mpz_class> b);
+    ReqPack(int id, int n1, int n2, PQT* out);
+    ReqPack(int id, int n1, int n2, std::shared_ptr<mpz_class> a);
+    ReqPack(int id, const mpz_class* a, const mpz_class* b, mpz_class* out, const Residues* ra = nullptr, const Residues* rb = nullptr, Residues* rout = nullptr);
     ReqPack(int id, std::shared_ptr<mpf_class> fa);
     ReqPack(int id, std::shared_ptr<mpf_class> fa, std::shared_ptr<mpf_class> fb);
-    ReqPack(int id, std::shared_ptr<mpz_class> a, std::shared_ptr<mpz_class> b, std::shared_ptr<mpz_class> c, std::shared_ptr<mpz_class> d);
+    // T of pqt += t2, its T2 slot, see PQTPool::AddT2()
+    ReqPack(int id, PQT* pqt, const mpz_class* t2);
+    ReqPack(const ReqPack&) = delete;
+    ReqPack& operator=(const ReqPack&) = delete;
+    ReqPack(ReqPack&&) = default;
+    ReqPack& operator=(ReqPack&&) = default;
     int GetID();
     int GetN1();
     int GetN2();
     PackType GetType();
-    std::shared_ptr<mpz_class> Geta();
-    std::shared_ptr<mpz_class> Getb();
-    std::shared_ptr<mpz_class> Getc();
-    std::shared_ptr<mpz_class> Getd();
-    std::shared_ptr<mpf_class> Getfa();
-    std::shared_ptr<mpf_class> Getfb();
+    const std::shared_ptr<mpz_class>& Geta();
+    const std::shared_ptr<mpf_class>& Getfa();
+    const std::shared_ptr<mpf_class>& Getfb();
+    const mpz_class* Getpa();
+    const mpz_class* Getpb();
+    mpz_class* Getout();
+    PQT* GetPQT();
+    const Residues* GetRa();
+    const Residues* GetRb();
+    Residues* GetRout();
+    int64_t GetQueued();
     void Invalidate();
     bool IsValid();
 };
@@ -44,25 +90,31 @@ class RespPack {
     int id_;
     int n1_;
     int n2_;
-    std::shared_ptr<PQT> result_;
+    int worker_;
+    PQT* result_ = nullptr;
     PackType type_;
-    std::shared_ptr<mpz_class> a_;
     std::shared_ptr<mpf_class> fa_;
 public:
     RespPack();
-    RespPack(int id, int n1, int n2, std::shared_ptr<PQT> result);
-    RespPack(int id, std::shared_ptr<PQT> result);
-    RespPack(ReqPack& rp, std::shared_ptr<PQT> result);
-    RespPack(int id, std::shared_ptr<mpz_class> a);
-    RespPack(ReqPack& rp, std::shared_ptr<mpz_class> a);
+    RespPack(int id, int n1, int n2, PQT* result);
+    RespPack(int id, PQT* result);
+    RespPack(ReqPack& rp, PQT* result);
+    // the result was written in place
+    RespPack(ReqPack& rp);
     RespPack(ReqPack& rp, std::shared_ptr<mpf_class> fa);
+    RespPack(const RespPack&) = delete;
+    RespPack& operator=(const RespPack&) = delete;
+    RespPack(RespPack&&) = default;
+    RespPack& operator=(RespPack&&) = default;
     int GetID();
     int GetN1();
     int GetN2();
-    std::shared_ptr<PQT> GetResult();
+    PQT* GetResult();
+    PQT* TakeResult();
     PackType GetType();
-    std::shared_ptr<mpz_class> Geta();
-    std::shared_ptr<mpf_class> Getfa();
+    const std::shared_ptr<mpf_class>& Getfa();
+    int GetWorker();
+    void SetWorker(int worker);
     void Invalidate();
     bool IsValid();
 };
@@ -1,6 +1,17 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define VERIFY(STR, INDEX, LEN) verify(STR, INDEX, LEN, _##INDEX)
 
@@ -59,32 +70,280 @@ string _1200000000 = "72912593081212086869129310622322863444636299583604"; // :
 string _1500000000 = "28645378082135603814855914764072758306381217050377"; // : 1,500,000,000
 string _2000000000 = "86430813147294569162304083903758389223023009559510"; // : 2,000,000,000
 
-bool verify(string input, int index, int len, string ans) {
-    if (input.size() < index && input.size() < index-len) {
-        cerr << " [*] Not that long, ignore this test. " << input.size() << " < index(" << index << ")" << endl;
+// a read-only mapping of a whole file
+struct MappedFile {
+    const char* data;
+    size_t size;
+
+    explicit MappedFile(const string& path): data(nullptr), size(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                data = static_cast<const char*>(p);
+                size = st.st_size;
+                madvise(p, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (data) munmap(const_cast<char*>(data), size);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// the decimals of the output, within its mapping
+struct Decimals {
+    const char* data;
+    long size;
+};
+
+// the len decimals ending at index are ans
+bool verify(const Decimals& input, long index, long len, const string& ans) {
+    if (input.size < index) {
+        cerr << " [*] Not that long, ignore this test. " << input.size << " < index(" << index << ")" << endl;
         return 0;
     }
 
-    string ss = input.substr(index-len, len);
-    if (ss == ans) {
+    if (memcmp(input.data + index - len, ans.data(), len) == 0) {
         cerr << " [O] Pass at index = " << index << endl;
         return 0;
     }
 
     cerr << " [X] Failed at index = " << index << endl;
-    cerr << " [*] input = " << ss << endl;
+    cerr << " [*] input = " << string(input.data + index - len, len) << endl;
     cerr << " [*] ans   = " << ans << endl;
     return -1;
 }
 
-int main() {
-    string input;
-    ifstream ifs("pi_concurrent.txt");
-    ifs >> input;
+// size of the chunks compared by the threads
+const size_t COMPARE_CHUNK = 1 << 24;
+
+// compare two digit files by chunks on all cores, and print the position of the first different byte, 0 if they are the same
+int Compare(const string& path1, const string& path2, int workers) {
+    MappedFile a(path1), b(path2);
+    if (!a.data || !b.data) {
+        cerr << " [X] Cannot read " << (a.data ? path2 : path1) << endl;
+        cout << 1 << endl;
+        return -1;
+    }
+
+    // a shorter file differs at its end, unless a chunk before differs
+    size_t size = min(a.size, b.size), chunks = (size + COMPARE_CHUNK - 1) / COMPARE_CHUNK;
+    atomic<size_t> next(0), first(a.size == b.size ? SIZE_MAX : size);
+    auto work = [&]() {
+        for (size_t c; (c = next++) < chunks && c * COMPARE_CHUNK < first;) {
+            size_t begin = c * COMPARE_CHUNK, len = min(COMPARE_CHUNK, size - begin);
+            if (memcmp(a.data + begin, b.data + begin, len) == 0) continue;
+            size_t pos = begin;
+            while (a.data[pos] == b.data[pos]) pos++;
+            for (size_t cur = first; pos < cur && !first.compare_exchange_weak(cur, pos););
+        }
+    };
+    vector<thread> threads;
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(work);
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+
+    if (first == SIZE_MAX) {
+        cerr << " [O] Same " << size << " bytes" << endl;
+        cout << 0 << endl;
+        return 0;
+    }
+    size_t pos = first;
+    cerr << " [X] First difference at byte " << pos + 1 << " of " << a.size << " and " << b.size << " bytes" << endl;
+    cout << pos + 1 << endl;
+    return -1;
+}
+
+/*
+ * BBP check of hex digits: frac(16^d pi) = frac(4 S(1) - 2 S(4) - S(5) - S(6)), S(j) = sum_k 16^(d-k) / (8k+j),
+ * gives the hex digits after the first d ones without the digits before them.
+ * The terms k <= d are (16^(d-k) mod (8k+j)) / (8k+j), by modular exponentiation, as 128-bit fixed point fractions,
+ * which add up modulo 1 by wrapping around. Every term is truncated by less than 2^-128, which bounds the error of the sum.
+ */
+typedef unsigned __int128 uint128_t;
+
+// hex digits checked by one evaluation of the formula
+const int BBP_BLOCK = 20;
+// terms k > d which are not below 2^-128
+const int BBP_TAIL = 32;
+
+static uint64_t MulMod(uint64_t a, uint64_t b, uint64_t m) {
+    return m <= UINT32_MAX ? a * b % m : static_cast<uint64_t>(static_cast<uint128_t>(a) * b % m);
+}
+
+// 16^e mod m
+static uint64_t PowMod16(uint64_t e, uint64_t m) {
+    uint64_t r = 1 % m;
+    for (int bit = e ? 63 - __builtin_clzll(e) : -1; bit >= 0; bit--) {
+        r = MulMod(r, r, m);
+        if ((e >> bit) & 1) r = MulMod(r, 16, m);
+    }
+
+    return r;
+}
+
+// floor(2^64 r / m) and its remainder, r < m
+static uint64_t DivWord(uint64_t r, uint64_t m, uint64_t& rest) {
+#if defined(__x86_64__)
+    uint64_t q;
+    // the quotient fits in 64 bits, so one divq does it instead of a 128-bit division
+    asm("divq %4" : "=a"(q), "=d"(rest) : "a"(0), "d"(r), "r"(m));
+    return q;
+#else
+    uint128_t n = static_cast<uint128_t>(r) << 64;
+    rest = static_cast<uint64_t>(n % m);
+    return static_cast<uint64_t>(n / m);
+#endif
+}
+
+// floor(2^128 r / m), r < m
+static uint128_t Fraction(uint64_t r, uint64_t m) {
+    uint64_t rest;
+    uint128_t high = DivWord(r, m, rest);
+
+    return (high << 64) + DivWord(rest, m, rest);
+}
+
+// 16^(d-k) / m, as 2^(128 - 4(k-d)) / m beyond d
+static uint128_t Term(uint64_t d, uint64_t k, uint64_t m) {
+    if (k <= d) return Fraction(PowMod16(d - k, m), m);
+    if (k - d >= BBP_TAIL) return 0;
+
+    return (static_cast<uint128_t>(1) << (128 - 4 * (k - d))) / m;
+}
+
+// term k of the series of m for the blocks d = first + b BBP_BLOCK, times coef, modulo 1
+static void AddTerms(uint64_t first, long blocks, uint64_t k, uint64_t m, uint128_t coef, uint128_t* sums) {
+    if (k > first) {
+        for (long b = 0; b < blocks; b++) {
+            sums[b] += coef * Term(first + b * BBP_BLOCK, k, m);
+        }
+        return;
+    }
+    // 16^(first-k) mod m, then 16^BBP_BLOCK times more for every next block
+    uint64_t r = PowMod16(first - k, m), step = blocks > 1 ? PowMod16(BBP_BLOCK, m) : 0;
+    for (long b = 0; b < blocks; b++) {
+        sums[b] += coef * Fraction(r, m);
+        r = MulMod(r, step, m);
+    }
+}
+
+// terms [k1, k2) of frac(16^d pi) for the blocks d = first + b BBP_BLOCK, modulo 1
+static void BBPTerms(uint64_t first, long blocks, uint64_t k1, uint64_t k2, uint128_t* sums) {
+    for (uint64_t k = k1; k < k2; k++) {
+        AddTerms(first, blocks, k, 8 * k + 1, 4, sums);
+        AddTerms(first, blocks, k, 8 * k + 4, -static_cast<uint128_t>(2), sums);
+        AddTerms(first, blocks, k, 8 * k + 5, -static_cast<uint128_t>(1), sums);
+        AddTerms(first, blocks, k, 8 * k + 6, -static_cast<uint128_t>(1), sums);
+    }
+}
+
+static string HexOf(uint128_t x, int n) {
+    string hex(n, '0');
+    for (int i = 0; i < n; i++) {
+        hex[i] = "0123456789abcdef"[static_cast<int>(x >> (124 - 4 * i)) & 15];
+    }
+
+    return hex;
+}
+
+// check the hex digits of a "{first} {digits}" file, first being the number of hex digits before them
+int VerifyHex(const string& path, int workers) {
+    ifstream ifs(path);
+    long first = -1;
+    string hex;
+    ifs >> first >> hex;
+    if (first < 0 || hex.empty() || hex.find_first_not_of("0123456789abcdef") != string::npos) {
+        cerr << " [X] Cannot read hex digits from " << path << endl;
+        return -1;
+    }
+    cerr << " [*] hex digits [" << first << ", " << first + hex.size() << ") with " << workers << " threads" << endl;
 
-    cerr << " [*] input size = " << input.size() << endl;
-    if (input.size() > 2) input = input.substr(2, input.size()-2);
-    else return -1;
+    // the terms are split in chunks, taken by the threads one after the other, and every chunk sums all the blocks
+    long blocks = (hex.size() + BBP_BLOCK - 1) / BBP_BLOCK, chunks = 4 * workers;
+    uint64_t terms = first + (blocks - 1) * BBP_BLOCK + BBP_TAIL;
+    vector<uint128_t> partial(chunks * blocks);
+    atomic<long> next(0);
+    auto work = [&]() {
+        for (long c; (c = next++) < chunks;) {
+            BBPTerms(first, blocks, terms * c / chunks, terms * (c + 1) / chunks, &partial[c * blocks]);
+        }
+    };
+    vector<thread> threads;
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(work);
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+
+    for (long b = 0; b < blocks; b++) {
+        uint64_t d = first + b * BBP_BLOCK;
+        int n = min<long>(BBP_BLOCK, hex.size() - b * BBP_BLOCK);
+        uint128_t x = 0, h = 0;
+        for (long c = 0; c < chunks; c++) {
+            x += partial[c * blocks + b];
+        }
+        for (int i = 0; i < n; i++) {
+            h = h * 16 + stoi(hex.substr(b * BBP_BLOCK + i, 1), nullptr, 16);
+        }
+        // x is within err of frac(16^d pi), which is in [h, h + 1) / 16^n if the digits are right
+        uint128_t err = 8 * static_cast<uint128_t>(d + BBP_TAIL + 1), width = static_cast<uint128_t>(1) << (128 - 4 * n);
+        if (static_cast<uint128_t>(x - (h << (128 - 4 * n)) + err) < width + 2 * err) {
+            cerr << " [O] Pass at hex index = " << d + n << endl;
+            continue;
+        }
+
+        cerr << " [X] Failed at hex index = " << d + n << endl;
+        cerr << " [*] input = " << hex.substr(b * BBP_BLOCK, n) << endl;
+        cerr << " [*] bbp   = " << HexOf(x, n) << endl;
+        return -1;
+    }
+
+    cerr << " [O] Great, all passed" << endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // -x [file] [threads]: BBP check of the hex digits written by pi -x
+    if (argc > 1 && string(argv[1]) == "-x") {
+        int workers = argc > 3 ? stoi(argv[3]) : thread::hardware_concurrency();
+        return VerifyHex(argc > 2 ? argv[2] : "pi_hex.txt", max(workers, 1));
+    }
+
+    // -c {file} {file} [threads]: compare two outputs
+    if (argc > 3 && string(argv[1]) == "-c") {
+        int workers = argc > 4 ? stoi(argv[4]) : thread::hardware_concurrency();
+        return Compare(argv[2], argv[3], max(workers, 1));
+    }
+
+    // [file] [known]: the decimals of known, lines of "{index} {decimals ending at index}", and of the table
+    MappedFile file(argc > 1 ? argv[1] : "pi_concurrent.txt");
+    // without the '\n' at the end
+    long size = file.size;
+    while (size > 0 && (file.data[size-1] == '\n' || file.data[size-1] == '\r')) size--;
+
+    cerr << " [*] input size = " << size << endl;
+    if (size <= 2) return -1;
+    Decimals input = {file.data + 2, size - 2};
+
+    if (argc > 2) {
+        ifstream known(argv[2]);
+        long index;
+        string ans;
+        while (known >> index >> ans) {
+            if (index < static_cast<long>(ans.size()) || verify(input, index, ans.size(), ans)) return -1;
+        }
+    }
 
     if (VERIFY(input, 50, 50)) return -1;
     if (VERIFY(input, 100, 50)) return -1;
@@ -0,0 +1,258 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "writer.hpp"
+
+// number of writes in flight on the ring
+static const unsigned WRITER_QUEUE_DEPTH = 32;
+
+static int IoUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int IoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+AsyncWriter::AsyncWriter(const std::string& filename):
+    fd_(-1), direct_(true), failed_(false), bytes_(0), ring_fd_(-1), ring_entries_(0), inflight_(0),
+    sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sq_size_(0), cq_size_(0), sqes_(nullptr), busy_(false), stop_(false) {
+    fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd_ < 0) {
+        // e.g. tmpfs does not support O_DIRECT
+        direct_ = false;
+        fd_ = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd_ < 0) return;
+
+    if (!SetupRing(WRITER_QUEUE_DEPTH)) {
+        thread_ = std::thread(&AsyncWriter::WriterThread, this);
+    }
+}
+
+AsyncWriter::~AsyncWriter() {
+    Finish(bytes_);
+}
+
+bool AsyncWriter::SetupRing(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = IoUringSetup(entries, &params);
+    // not supported by the kernel, or forbidden, e.g. by seccomp
+    if (ring_fd_ < 0) return false;
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+
+    sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        CloseRing();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            CloseRing();
+            return false;
+        }
+    }
+    void* sqes = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        CloseRing();
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    char* cq = static_cast<char*>(cq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    ring_entries_ = params.sq_entries;
+    slots_.resize(ring_entries_);
+    for (unsigned i = 0; i < ring_entries_; i++) free_slots_.push_back(i);
+
+    return true;
+}
+
+void AsyncWriter::CloseRing() {
+    if (sqes_) munmap(sqes_, ring_entries_ * sizeof(io_uring_sqe));
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_size_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+    sqes_ = nullptr;
+    sq_ptr_ = cq_ptr_ = MAP_FAILED;
+    ring_fd_ = -1;
+}
+
+void AsyncWriter::SubmitRing(const Piece& piece) {
+    if (inflight_ == ring_entries_) Reap(1);
+
+    unsigned slot = free_slots_.back();
+    free_slots_.pop_back();
+    slots_[slot] = piece;
+
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd_;
+    sqe->addr = reinterpret_cast<unsigned long long>(piece.buf);
+    sqe->len = static_cast<unsigned>(piece.len);
+    sqe->off = piece.offset;
+    sqe->user_data = slot;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    inflight_++;
+
+    if (IoUringEnter(ring_fd_, 1, 0, 0) < 0) {
+        // the kernel did not take it, so take it back and write it here
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+        inflight_--;
+        free_slots_.push_back(slot);
+        WriteSync(piece);
+    }
+}
+
+void AsyncWriter::Reap(unsigned min_complete) {
+    while (true) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (min_complete == 0 || inflight_ == 0) return;
+            if (IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                failed_ = true;
+                return;
+            }
+            continue;
+        }
+
+        io_uring_cqe* cqe = &cqes_[head & *cq_mask_];
+        unsigned slot = static_cast<unsigned>(cqe->user_data);
+        Piece piece = slots_[slot];
+        int res = cqe->res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        free_slots_.push_back(slot);
+        inflight_--;
+        if (min_complete > 0) min_complete--;
+
+        if (res >= 0 && static_cast<size_t>(res) == piece.len) {
+            bytes_ += piece.len;
+        } else {
+            // short write, or an error such as O_DIRECT being refused for this write: finish it with pwrite
+            if (res > 0) {
+                bytes_ += res;
+                piece.buf += res;
+                piece.offset += res;
+                piece.len -= res;
+            }
+            WriteSync(piece);
+        }
+    }
+}
+
+void AsyncWriter::WriteSync(Piece piece) {
+    while (piece.len > 0) {
+        ssize_t res = pwrite(fd_, piece.buf, piece.len, piece.offset);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && direct_) {
+                // the file system refuses O_DIRECT writes, go on through the page cache
+                direct_ = false;
+                fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+            failed_ = true;
+            return;
+        }
+        bytes_ += res;
+        piece.buf += res;
+        piece.offset += res;
+        piece.len -= res;
+    }
+}
+
+void AsyncWriter::WriterThread() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    while (true) {
+        cv_.wait(lock, [this] {return stop_ || !pieces_.empty();});
+        if (pieces_.empty()) return;
+
+        Piece piece = pieces_.front();
+        pieces_.pop_front();
+        busy_ = true;
+        lock.unlock();
+        WriteSync(piece);
+        lock.lock();
+        busy_ = false;
+        cv_.notify_all();
+    }
+}
+
+std::string AsyncWriter::Describe() const {
+    std::string desc = ring_fd_ >= 0 ? "io_uring" : "pwrite";
+    if (direct_) desc += ", O_DIRECT";
+
+    return desc;
+}
+
+void AsyncWriter::Submit(const char* buf, size_t offset, size_t len) {
+    if (fd_ < 0 || len == 0) return;
+
+    Piece piece = {buf, offset, len};
+    if (ring_fd_ >= 0) {
+        Reap(0);
+        SubmitRing(piece);
+    } else {
+        std::lock_guard<std::mutex> lock(mtx_);
+        pieces_.push_back(piece);
+        cv_.notify_all();
+    }
+}
+
+void AsyncWriter::Wait() {
+    if (fd_ < 0) return;
+
+    if (ring_fd_ >= 0) {
+        Reap(inflight_);
+    } else {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] {return pieces_.empty() && !busy_;});
+    }
+}
+
+bool AsyncWriter::Finish(size_t size) {
+    if (fd_ < 0) return false;
+
+    Wait();
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+    CloseRing();
+
+    if (ftruncate(fd_, size) < 0) failed_ = true;
+    if (close(fd_) < 0) failed_ = true;
+    fd_ = -1;
+
+    return !failed_;
+}
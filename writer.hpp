@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/io_uring.h>
+
+// offsets and lengths of the writes are multiples of it, as O_DIRECT needs
+const size_t WRITER_ALIGN = 4096;
+// size of the chunks of digits handed to the writer
+const size_t WRITER_CHUNK = 1 << 22;
+
+/*
+ * Asynchronous writer of one file, by pieces written at their offset, in any order.
+ * Writes go through io_uring when the kernel allows it, otherwise through a background thread calling pwrite().
+ * The file is opened with O_DIRECT when the file system supports it, so that the digits bypass the page cache.
+ * For that, buffers must be aligned to WRITER_ALIGN, and offsets and lengths must be multiples of it:
+ * the last piece is padded, and Finish() cuts the file at its real size.
+ */
+class AsyncWriter {
+    struct Piece {
+        const char* buf;
+        size_t offset, len;
+    };
+
+    int fd_;
+    bool direct_, failed_;
+    size_t bytes_;
+
+    // io_uring
+    int ring_fd_;
+    unsigned ring_entries_, inflight_;
+    void *sq_ptr_, *cq_ptr_;
+    size_t sq_size_, cq_size_;
+    io_uring_sqe* sqes_;
+    unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_, *cq_head_, *cq_tail_, *cq_mask_;
+    io_uring_cqe* cqes_;
+    std::vector<Piece> slots_;
+    std::vector<unsigned> free_slots_;
+
+    // pwrite thread
+    std::thread thread_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<Piece> pieces_;
+    bool busy_, stop_;
+
+    bool SetupRing(unsigned entries);
+    void CloseRing();
+    void SubmitRing(const Piece& piece);
+    // reap at least min_complete completions
+    void Reap(unsigned min_complete);
+    void WriteSync(Piece piece);
+    void WriterThread();
+
+public:
+    explicit AsyncWriter(const std::string& filename);
+    ~AsyncWriter();
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    bool IsOpen() const {return fd_ >= 0;}
+    // e.g. "io_uring, O_DIRECT"
+    std::string Describe() const;
+    // buf must stay untouched until the piece is written, i.e. until Wait()
+    void Submit(const char* buf, size_t offset, size_t len);
+    // wait until all submitted pieces are written
+    void Wait();
+    // wait, cut the file at size and close it, false if any write failed
+    bool Finish(size_t size);
+    // bytes written so far
+    size_t GetBytes() const {return bytes_;}
+};